@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/.
+#
+
+"""Benchmarks the simulator across topology sizes, traffic rates and fidelity schedules.
+
+Each case is one Cmdenv run of the generated tree network (TCPTree / UDPTree)
+with the given size ("<fusion nodes>x<sensors per fusion node>"), the interval
+between a host's requests (thinkTime for TCP, sendInterval for UDP) and a
+fidelitySchedule; the empty schedule is the full-fidelity reference. Cases run
+one after another so that they do not compete for cores. For each case the
+results file gets events per second, wall-clock seconds per simulated second,
+peak RSS and the controller's transition latency (simulated time from the start
+of a window until its direct traffic starts), plus the speedup of every
+schedule over full fidelity.
+
+    ./benchmark.py
+    ./benchmark.py --protocols TCP --sizes 2x2,50x10 --schedule "" --schedule "100s 200s 1"
+    ./benchmark.py --baseline results/benchmark-old.json   # exit status 1 on a slowdown
+"""
+
+import argparse
+import json
+import os
+import platform
+import shlex
+import subprocess
+import sys
+import time
+
+from replicate import HERE, finite, read_statistics
+
+DEFAULT_SCHEDULES = {'TCP': ['', '100s 200s 1', '100s 200s 2'], 'UDP': ['', '100s 200s 1', '100s 200s 2']}
+
+
+class Case:
+    def __init__(self, protocol, size, interval, schedule):
+        self.protocol = protocol
+        self.fusion, self.sensors = (int(n) for n in size.split('x'))
+        self.size = size
+        self.interval = interval
+        self.schedule = schedule
+        self.name = '%s-%s-%gs-%s' % (protocol, size, interval, schedule.replace(' ', '_').replace(';', '+') or 'full')
+
+    def key(self):
+        return (self.protocol, self.size, self.interval, self.schedule)
+
+    def command(self, args, result_dir):
+        cmd = [args.executable, '-u', 'Cmdenv', '-c', self.protocol + 'Tree', '-r', '0', '-n', args.ned_path,
+               '--cmdenv-express-mode=true',
+               '--result-dir=%s' % result_dir,
+               '--*.numFusionNodes=%d' % self.fusion,
+               '--*.sensorsPerFusionNode=%d' % self.sensors,
+               '--*.aggregationLevels=1',
+               '--*.EC*.fidelitySchedule="%s"' % self.schedule]
+        if self.protocol == 'TCP':
+            cmd.append('--**.app[*].thinkTime=%gs' % self.interval)
+        else:
+            cmd.append('--**.app[*].sendInterval=%gs' % self.interval)
+        if args.time_limit:
+            cmd.append('--sim-time-limit=%s' % args.time_limit)
+        cmd.append(args.ini)
+        return cmd
+
+    def execute(self, args, out_dir, repetition):
+        """One run; returns the measured row, or None if the run failed."""
+        result_dir = os.path.join(out_dir, self.name, str(repetition))
+        os.makedirs(result_dir, exist_ok=True)
+        start = time.time()
+        with open(os.path.join(result_dir, 'cmdenv.log'), 'w') as log:
+            process = subprocess.Popen(self.command(args, result_dir), cwd=HERE, stdout=log, stderr=subprocess.STDOUT)
+            # the resources of this child alone, unlike RUSAGE_CHILDREN
+            _, status, usage = os.wait4(process.pid, 0)
+        wall = time.time() - start
+        if status != 0:
+            print('  %s failed, see %s' % (self.name, os.path.join(result_dir, 'cmdenv.log')))
+            return None
+
+        sca = next((os.path.join(result_dir, f) for f in sorted(os.listdir(result_dir)) if f.endswith('.sca')), None)
+        scalars = read_scalars(sca) if sca else {}
+        latency = (read_statistics(sca) if sca else {}).get('transitionLatency', {})
+        events = scalars.get('events', float('nan'))
+        simulated = scalars.get('simulatedTime', float('nan'))
+        run_wall = scalars.get('runWallTime', wall)
+        return {
+            'wallTime': wall,  # including network setup
+            'runWallTime': run_wall,  # from the end of initialization on
+            'events': events,
+            'simulatedTime': simulated,
+            'eventsPerSecond': events / run_wall if run_wall > 0 else float('nan'),
+            'wallPerSimSecond': run_wall / simulated if simulated > 0 else float('nan'),
+            'peakRssMB': usage.ru_maxrss / 1024.0,  # kilobytes on Linux
+            'transitions': latency.get('count', 0),
+            'transitionLatencyMean': latency.get('mean', float('nan')),
+            'transitionLatencyMax': latency.get('max', float('nan')),
+        }
+
+
+def read_scalars(path):
+    """{name: value} of the controller's scalars in a .sca file."""
+    scalars = {}
+    with open(path) as f:
+        for line in f:
+            if line.startswith('scalar '):
+                fields = shlex.split(line)
+                if fields[1].endswith('.EC'):
+                    scalars[fields[2]] = float(fields[3])
+    return scalars
+
+
+def version():
+    try:
+        return subprocess.check_output(['git', 'describe', '--always', '--dirty'], cwd=HERE, stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def speedups(rows):
+    """Full-fidelity wall time per simulated second over that of each schedule, per protocol, size and interval."""
+    reference = {(r['protocol'], r['size'], r['interval']): r['wallPerSimSecond'] for r in rows if r['schedule'] == ''}
+    result = []
+    for r in rows:
+        full = reference.get((r['protocol'], r['size'], r['interval']))
+        if r['schedule'] and full and r['wallPerSimSecond'] > 0:
+            result.append({'protocol': r['protocol'], 'size': r['size'], 'interval': r['interval'],
+                           'schedule': r['schedule'], 'speedup': full / r['wallPerSimSecond']})
+    return result
+
+
+def compare(rows, baseline_path, tolerance):
+    """Cases whose events per second dropped by more than tolerance against the baseline."""
+    with open(baseline_path) as f:
+        baseline = {(r['protocol'], r['size'], r['interval'], r['schedule']): r for r in json.load(f)['cases']}
+    slower = []
+    for r in rows:
+        old = baseline.get((r['protocol'], r['size'], r['interval'], r['schedule']))
+        if not old or not old.get('eventsPerSecond') or not r.get('eventsPerSecond'):
+            continue
+        ratio = r['eventsPerSecond'] / old['eventsPerSecond']
+        r['baselineRatio'] = ratio
+        if ratio < 1 - tolerance:
+            slower.append(r)
+    return slower
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--protocols', default='TCP,UDP')
+    parser.add_argument('--sizes', default='2x2,10x10,50x10', help='"<fusion nodes>x<sensors per fusion node>,..." (default: 2x2,10x10,50x10)')
+    parser.add_argument('--intervals', default='0.2,0.05', help='seconds between the requests of a host (default: 0.2,0.05)')
+    parser.add_argument('--schedule', action='append', dest='schedules',
+                        help='fidelitySchedule, "" for full fidelity; repeatable (default: full, a layer-1 and a layer-2 window)')
+    parser.add_argument('--time-limit', default=None, help='sim-time-limit of every run (default: that of the ini file)')
+    parser.add_argument('--repeat', type=int, default=1, help='runs per case; the fastest one is reported')
+    parser.add_argument('--executable', default=os.path.join(HERE, '..', 'src', 'research'), help='simulation binary')
+    parser.add_argument('--ned-path', default='.:../src:../../inet/src', help='NED path, relative to this directory')
+    parser.add_argument('--ini', default='omnetpp.ini')
+    parser.add_argument('--out', default=os.path.join(HERE, 'results', 'benchmark.json'), help='results file (default: results/benchmark.json)')
+    parser.add_argument('--baseline', default=None, help='earlier results file to compare events per second against')
+    parser.add_argument('--tolerance', type=float, default=0.1, help='slowdown against the baseline that fails the benchmark (default: 0.1)')
+    args = parser.parse_args()
+
+    cases = [Case(protocol, size, float(interval), schedule)
+             for protocol in args.protocols.split(',')
+             for size in args.sizes.split(',')
+             for interval in args.intervals.split(',')
+             for schedule in (args.schedules if args.schedules is not None else DEFAULT_SCHEDULES[protocol])]
+    out_dir = os.path.join(os.path.dirname(os.path.abspath(args.out)), 'benchmark')
+
+    rows = []
+    failed = 0
+    for n, case in enumerate(cases, 1):
+        runs = [row for row in (case.execute(args, out_dir, i) for i in range(args.repeat)) if row]
+        if not runs:
+            failed += 1
+            continue
+        best = min(runs, key=lambda row: row['runWallTime'])
+        best.update({'protocol': case.protocol, 'size': case.size, 'hosts': 1 + case.fusion * (1 + case.sensors),
+                     'interval': case.interval, 'schedule': case.schedule})
+        rows.append(best)
+        print('[%d/%d] %-40s %10.0f events/s  %8.4f s/simulated s  %7.1f MB' % (n, len(cases), case.name,
+              best['eventsPerSecond'], best['wallPerSimSecond'], best['peakRssMB']))
+        sys.stdout.flush()
+
+    report = {'version': version(), 'host': platform.node(), 'python': platform.python_version(),
+              'time': time.strftime('%Y-%m-%dT%H:%M:%S'), 'cases': rows, 'speedups': speedups(rows)}
+    slower = compare(rows, args.baseline, args.tolerance) if args.baseline else []
+    os.makedirs(os.path.dirname(os.path.abspath(args.out)), exist_ok=True)
+    with open(args.out, 'w') as f:
+        json.dump(finite(report), f, indent=2)
+
+    for s in report['speedups']:
+        print('%s %s %gs "%s": %.2fx faster than full fidelity' % (s['protocol'], s['size'], s['interval'], s['schedule'], s['speedup']))
+    for r in slower:
+        print('SLOWER: %s %s %gs "%s" at %.0f%% of the baseline' % (r['protocol'], r['size'], r['interval'], r['schedule'], 100 * r['baselineRatio']))
+    print('results: %s' % args.out)
+    return 1 if failed or slower else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/.
+#
+
+"""Reads the .col files written by the "columnar" result recorder.
+
+The format is described in src/common/ColumnarRecorder.h. Without options the
+vectors of a file are listed with their number of samples per fidelity layer;
+--csv writes the samples of the vectors whose module or name contains --match.
+
+    ./columnar.py results/TCPColumnar-0.col
+    ./columnar.py results/TCPColumnar-0.col --match directTimes --csv direct.csv
+"""
+
+import argparse
+import collections
+import csv
+import struct
+import sys
+
+MAGIC = b'CPSCOL1\n'
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def raw(self, fmt):
+        values = struct.unpack_from('<' + fmt, self.data, self.pos)
+        self.pos += struct.calcsize('<' + fmt)
+        return values
+
+    def varint(self):
+        value = shift = 0
+        while True:
+            byte = self.data[self.pos]
+            self.pos += 1
+            value |= (byte & 0x7f) << shift
+            if byte < 0x80:
+                return value
+            shift += 7
+
+    def zigzag(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def string(self):
+        (length,) = self.raw('H')
+        text = self.data[self.pos:self.pos + length].decode()
+        self.pos += length
+        return text
+
+
+def read(path):
+    """{(module, result name): {'time': [...], 'layer': [...], 'value': [...]}} in seconds."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if not data.startswith(MAGIC):
+        raise ValueError('%s is not a columnar result file' % path)
+    r = Reader(data)
+    r.pos = len(MAGIC)
+    (scale_exp,) = r.raw('b')
+    divisor = 10 ** -scale_exp
+    names = {}
+    vectors = collections.OrderedDict()
+    while r.pos < len(data):
+        record = data[r.pos:r.pos + 1]
+        r.pos += 1
+        if record == b'V':
+            (vector_id,) = r.raw('I')
+            module = r.string()
+            names[vector_id] = (module, r.string())
+            vectors[names[vector_id]] = {'time': [], 'layer': [], 'value': []}
+        elif record == b'B':
+            vector_id, rows = r.raw('II')
+            columns = vectors[names[vector_id]]
+            time = 0
+            for _ in range(rows):
+                time += r.varint()
+                columns['time'].append(time / divisor)
+            filled = 0
+            while filled < rows:
+                length = r.varint()
+                columns['layer'].extend([r.zigzag()] * length)
+                filled += length
+            (encoding,) = r.raw('B')
+            if encoding == 1:
+                value = 0
+                for _ in range(rows):
+                    value += r.zigzag()
+                    columns['value'].append(float(value))
+            else:
+                columns['value'].extend(r.raw('%dd' % rows))
+        else:
+            raise ValueError('%s: unknown record %r at offset %d' % (path, record, r.pos - 1))
+    return vectors
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('file', help='.col file')
+    parser.add_argument('--match', default='', help='only vectors whose module or name contains this')
+    parser.add_argument('--csv', help='write module,name,time,layer,value rows to this file ("-": stdout)')
+    args = parser.parse_args()
+
+    vectors = collections.OrderedDict((key, columns) for key, columns in read(args.file).items()
+                                      if args.match in key[0] or args.match in key[1])
+    if args.csv:
+        f = sys.stdout if args.csv == '-' else open(args.csv, 'w', newline='')
+        writer = csv.writer(f)
+        writer.writerow(['module', 'name', 'time', 'layer', 'value'])
+        for (module, name), columns in vectors.items():
+            for row in zip(columns['time'], columns['layer'], columns['value']):
+                writer.writerow([module, name] + list(row))
+        if f is not sys.stdout:
+            f.close()
+        return 0
+
+    for (module, name), columns in vectors.items():
+        layers = collections.Counter(columns['layer'])
+        print('%-40s %-30s %8d  %s' % (module, name, len(columns['time']),
+              ' '.join('L%d:%d' % (layer, n) for layer, n in sorted(layers.items()))))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
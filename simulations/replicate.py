@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see http://www.gnu.org/licenses/.
+#
+
+"""Runs replications of one configuration in parallel and merges their results.
+
+Every combination of seed set and fidelity schedule is one Cmdenv run with its
+own result directory. Runs are handed out one at a time to a pool of workers,
+so a worker that finishes early takes the next pending run instead of idling
+behind a slow one. Afterwards the controller's message-time histograms
+(tcpMsgStats/udpMsgStats, directMsgStats) and wallTimes
+vectors are merged into one report with 95% confidence intervals over the
+replications.
+
+    ./replicate.py -c TCP --seeds 0-31
+    ./replicate.py -c UDP --seeds 0-9 --schedule "100s 200s 1" --schedule "100s 200s 2"
+"""
+
+import argparse
+import concurrent.futures
+import json
+import math
+import os
+import shlex
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# two-sided 95% quantiles of Student's t for 1..30 degrees of freedom
+T_95 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042]
+
+
+def parse_seeds(spec):
+    """"0-3,7" -> [0, 1, 2, 3, 7]"""
+    seeds = []
+    for part in spec.split(','):
+        if '-' in part:
+            first, last = part.split('-')
+            seeds.extend(range(int(first), int(last) + 1))
+        elif part:
+            seeds.append(int(part))
+    return seeds
+
+
+def confidence(values):
+    """Mean and half-width of its 95% confidence interval; no interval for one value."""
+    n = len(values)
+    if n == 0:
+        return float('nan'), float('nan')
+    mean = sum(values) / n
+    if n == 1:
+        return mean, float('nan')
+    var = sum((v - mean) ** 2 for v in values) / (n - 1)
+    t = T_95[n - 2] if n - 1 <= len(T_95) else 1.960
+    return mean, t * math.sqrt(var / n)
+
+
+class Run:
+    def __init__(self, config, seed, schedule, index, out_dir):
+        self.config = config
+        self.seed = seed
+        self.schedule = schedule  # None: the schedule of the ini file
+        self.name = 's%d' % seed if schedule is None else 'sched%d-s%d' % (index, seed)
+        self.schedule_index = index
+        self.dir = os.path.join(out_dir, self.name)
+        self.returncode = None
+        self.elapsed = 0.0
+
+    def command(self, args):
+        cmd = [args.executable, '-u', 'Cmdenv', '-c', self.config, '-n', args.ned_path,
+               '--cmdenv-express-mode=true',
+               '--seed-set=%d' % self.seed,
+               '--result-dir=%s' % self.dir]
+        if self.schedule is not None:
+            cmd.append('--*.EC.fidelitySchedule="%s"' % self.schedule)
+        cmd.extend(args.extra)
+        cmd.append(args.ini)
+        return cmd
+
+    def execute(self, args):
+        os.makedirs(self.dir, exist_ok=True)
+        start = time.time()
+        with open(os.path.join(self.dir, 'cmdenv.log'), 'w') as log:
+            self.returncode = subprocess.call(self.command(args), cwd=HERE, stdout=log, stderr=subprocess.STDOUT)
+        self.elapsed = time.time() - start
+        return self
+
+
+def read_statistics(path):
+    """{name: {'count': .., 'sum': .., 'sqrsum': .., 'min': .., 'max': .., 'mean': .., 'bins': [(lower, count)]}}
+    for the `statistic` blocks of the controller in a .sca file."""
+    stats = {}
+    current = None
+    with open(path) as f:
+        for line in f:
+            fields = shlex.split(line)
+            if not fields:
+                continue
+            if fields[0] == 'statistic':
+                module, name = fields[1], fields[2]
+                current = stats.setdefault(name, {'bins': []}) if module.endswith('.EC') else None
+            elif current is not None and fields[0] == 'field':
+                current[fields[1]] = float(fields[2])
+            elif current is not None and fields[0] == 'bin':
+                current['bins'].append((float(fields[1]), float(fields[2])))
+            elif fields[0] in ('scalar', 'vector', 'run'):
+                current = None
+    return stats
+
+
+def read_wall_times(path):
+    """[(simulation time, wall-clock seconds)] of the wallTimes vector in a .vec file."""
+    ids = set()
+    series = []
+    with open(path) as f:
+        for line in f:
+            if line.startswith('vector '):
+                fields = shlex.split(line)
+                if fields[3].startswith('wallTimes'):
+                    ids.add(fields[1])
+            elif line[:1].isdigit():
+                fields = line.split()
+                if fields[0] in ids and len(fields) >= 4:
+                    series.append((float(fields[2]), float(fields[3])))
+    return series
+
+
+def finite(value):
+    """Strict JSON: infinite bin edges and undefined intervals become null."""
+    if isinstance(value, float) and not math.isfinite(value):
+        return None
+    if isinstance(value, dict):
+        return {k: finite(v) for k, v in value.items()}
+    if isinstance(value, (list, tuple)):
+        return [finite(v) for v in value]
+    return value
+
+
+def find_result(run, suffix):
+    for name in sorted(os.listdir(run.dir)):
+        if name.endswith(suffix):
+            return os.path.join(run.dir, name)
+    return None
+
+
+def merge_statistics(per_run):
+    """Pools the histograms of one statistic over all runs in which it was recorded."""
+    recorded = [s for s in per_run if s.get('count', 0) > 0]
+    merged = {'runs': len(recorded)}
+    if not recorded:
+        return merged
+    count = sum(s['count'] for s in recorded)
+    total = sum(s.get('sum', s.get('mean', 0) * s['count']) for s in recorded)
+    sqrsum = sum(s.get('sqrsum', 0) for s in recorded)
+    merged['count'] = count
+    merged['mean'] = total / count
+    merged['stddev'] = math.sqrt(max(0.0, sqrsum / count - merged['mean'] ** 2)) if sqrsum else float('nan')
+    merged['min'] = min(s['min'] for s in recorded if 'min' in s)
+    merged['max'] = max(s['max'] for s in recorded if 'max' in s)
+    merged['replicationMean'], merged['replicationCI95'] = confidence([s['mean'] for s in recorded if 'mean' in s])
+    # the bins only add up if every run chose the same ones
+    edges = [[lower for lower, _ in s['bins']] for s in recorded]
+    if edges[0] and all(e == edges[0] for e in edges):
+        merged['bins'] = [(lower, sum(s['bins'][i][1] for s in recorded)) for i, lower in enumerate(edges[0])]
+    return merged
+
+
+def merge_wall_times(per_run, step):
+    """Mean wall-clock seconds (with CI) at every `step` simulated seconds, and at the end of the runs."""
+    per_run = [series for series in per_run if series]
+    if not per_run:
+        return [], (float('nan'), float('nan'))
+    horizon = min(series[-1][0] for series in per_run)
+    rows = []
+    t = step
+    while t <= horizon + 1e-9:
+        values = []
+        for series in per_run:
+            # last sample at or before t
+            value = 0.0
+            for sim_time, wall in series:
+                if sim_time > t:
+                    break
+                value = wall
+            values.append(value)
+        mean, half = confidence(values)
+        rows.append((t, mean, half))
+        t += step
+    return rows, confidence([series[-1][1] for series in per_run])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-c', '--config', required=True, help='configuration of omnetpp.ini, e.g. TCP or UDP')
+    parser.add_argument('--seeds', default='0-9', help='seed sets, e.g. "0-31" or "0,4,7" (default: 0-9)')
+    parser.add_argument('--schedule', action='append', dest='schedules',
+                        help='fidelitySchedule to run every seed with; repeatable (default: the one of the configuration)')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(), help='parallel runs (default: number of cores)')
+    parser.add_argument('--executable', default=os.path.join(HERE, '..', 'src', 'research'), help='simulation binary')
+    parser.add_argument('--ned-path', default='.:../src:../../inet/src', help='NED path, relative to this directory')
+    parser.add_argument('--ini', default='omnetpp.ini')
+    parser.add_argument('--out', default=None, help='result directory (default: results/replicate-<config>)')
+    parser.add_argument('--wall-step', type=float, default=10.0, help='simulated seconds between rows of the wall-clock table')
+    parser.add_argument('extra', nargs='*', help='further Cmdenv options, after "--"')
+    args = parser.parse_args()
+
+    out_dir = os.path.abspath(args.out or os.path.join(HERE, 'results', 'replicate-' + args.config))
+    schedules = args.schedules or [None]
+    runs = [Run(args.config, seed, schedule, index, out_dir)
+            for index, schedule in enumerate(schedules) for seed in parse_seeds(args.seeds)]
+
+    print('%d runs of %s on %d workers, results in %s' % (len(runs), args.config, args.jobs, out_dir))
+    start = time.time()
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        futures = [pool.submit(run.execute, args) for run in runs]
+        for done, future in enumerate(concurrent.futures.as_completed(futures), 1):
+            run = future.result()
+            status = 'ok' if run.returncode == 0 else 'FAILED (%d), see %s' % (run.returncode, os.path.join(run.dir, 'cmdenv.log'))
+            print('[%d/%d] %s %.1fs %s' % (done, len(runs), run.name, run.elapsed, status))
+            sys.stdout.flush()
+    elapsed = time.time() - start
+
+    report = {'config': args.config, 'runs': len(runs), 'elapsed': elapsed,
+              'sequential': sum(run.elapsed for run in runs), 'schedules': []}
+    for index, schedule in enumerate(schedules):
+        finished = [run for run in runs if run.schedule_index == index and run.returncode == 0]
+        stats = {}
+        walls = []
+        for run in finished:
+            sca = find_result(run, '.sca')
+            vec = find_result(run, '.vec')
+            for name, stat in (read_statistics(sca) if sca else {}).items():
+                stats.setdefault(name, []).append(stat)
+            walls.append(read_wall_times(vec) if vec else [])
+        rows, final = merge_wall_times(walls, args.wall_step)
+        report['schedules'].append({
+            'schedule': schedule,
+            'replications': len(finished),
+            'statistics': {name: merge_statistics(per_run) for name, per_run in sorted(stats.items())},
+            'wallClock': {'final': final[0], 'finalCI95': final[1], 'table': rows},
+        })
+
+    with open(os.path.join(out_dir, 'report.json'), 'w') as f:
+        json.dump(finite(report), f, indent=2)
+
+    print('\n%d runs in %.0fs (%.0fs sequential)' % (len(runs), elapsed, report['sequential']))
+    for entry in report['schedules']:
+        print('\nschedule: %s, %d replications' % (entry['schedule'] or 'from %s' % args.ini, entry['replications']))
+        for name, stat in entry['statistics'].items():
+            if stat['runs'] == 0:
+                print('  %-16s not recorded' % name)
+                continue
+            print('  %-16s mean %.6g +- %.3g  (pooled %.6g, sd %.3g, min %.6g, max %.6g, n %d)'
+                  % (name, stat['replicationMean'], stat['replicationCI95'], stat['mean'], stat['stddev'],
+                     stat['min'], stat['max'], stat['count']))
+        wall = entry['wallClock']
+        print('  %-16s %.3gs +- %.3g at the end of the run' % ('wall clock', wall['final'], wall['finalCI95']))
+    print('\nfull report: %s' % os.path.join(out_dir, 'report.json'))
+    return 0 if all(run.returncode == 0 for run in runs) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,78 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "BypassTcp.h"
+
+#include "inet/common/ModuleAccess.h"
+#include "inet/common/ProtocolTag_m.h"
+#include "inet/networklayer/common/L3AddressResolver.h"
+#include "inet/networklayer/common/L3AddressTag_m.h"
+
+namespace inet {
+
+Define_Module(BypassTcp);
+
+void BypassTcp::initialize(int stage) {
+    Tcp::initialize(stage);
+
+    if (stage == INITSTAGE_LOCAL) {
+        bypassInGateId = findGate("bypassIn");
+    }
+}
+
+bool BypassTcp::isLowerMessage(cMessage *msg) {
+    return msg->getArrivalGateId() == bypassInGateId || Tcp::isLowerMessage(msg);
+}
+
+void BypassTcp::sendFromConn(cMessage *msg, const char *gatename, int gateindex) {
+    Packet *packet = dynamic_cast<Packet *>(msg);
+    if (packet && strcmp(gatename, "ipOut") == 0 && bypass(packet))
+        return;
+    Tcp::sendFromConn(msg, gatename, gateindex);
+}
+
+bool BypassTcp::bypass(Packet *packet) {
+    ExperimentControl& control = ExperimentControl::getInstance();
+    cModule *host = getContainingNode(this);
+    auto addresses = packet->getTag<L3AddressReq>();
+    cModule *peerHost = control.findHost(addresses->getDestAddress());
+    if (!peerHost || !control.isBypassed(host->getFullName(), peerHost->getFullName()))
+        return false;
+
+    // an unbound connection leaves the source to ipv4, which is skipped here
+    L3Address srcAddress = addresses->getSrcAddress();
+    if (srcAddress.isUnspecified())
+        srcAddress = L3AddressResolver().addressOf(host, L3AddressResolver::ADDR_IPv4);
+    L3Address destAddress = addresses->getDestAddress();
+
+    simtime_t delay;
+    if (!control.getBypassDelay(host->getFullName(), peerHost->getFullName(), b(packet->getTotalLength()).get(), delay)) {
+        EV_INFO << "bypassed segment to " << peerHost->getFullName() << " lost" << endl;
+        delete packet;
+        return true;
+    }
+
+    // tags as ipv4 would have left them on delivery
+    packet->clearTags();
+    packet->addTag<PacketProtocolTag>()->setProtocol(&Protocol::tcp);
+    packet->addTag<NetworkProtocolInd>()->setProtocol(&Protocol::ipv4);
+    auto addressInd = packet->addTag<L3AddressInd>();
+    addressInd->setSrcAddress(srcAddress);
+    addressInd->setDestAddress(destAddress);
+    sendDirect(packet, delay, 0, peerHost->getSubmodule("tcp"), "bypassIn");
+    return true;
+}
+
+}
@@ -0,0 +1,51 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef BYPASSTCP_H_
+#define BYPASSTCP_H_
+
+#include "ExperimentControl.h"
+#include "inet/common/INETDefs.h"
+
+#include "inet/common/packet/Packet.h"
+#include "inet/transportlayer/tcp/Tcp.h"
+
+namespace inet {
+
+/**
+ * Tcp that hands its segments straight to the peer host's BypassTcp while
+ * the ExperimentControl runs their link at layer 2. The segment skips ipv4
+ * and ppp; the controller models the route's delay, serialization, queueing
+ * and packet error rate, so congestion control still sees realistic RTTs
+ * and losses.
+ */
+class BypassTcp : public tcp::Tcp {
+
+    protected:
+        int bypassInGateId = -1;
+
+        virtual void initialize(int stage) override;
+        virtual bool isLowerMessage(cMessage *msg) override;
+
+        // true if the segment was taken off the IP path (delivered or lost)
+        virtual bool bypass(Packet *packet);
+
+    public:
+        virtual void sendFromConn(cMessage *msg, const char *gatename, int gateindex = -1) override;
+};
+
+}
+
+#endif /* BYPASSTCP_H_ */
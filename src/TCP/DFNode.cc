@@ -59,6 +59,7 @@ void DFNode::initialize(int stage)
         WATCH(msgsSent);
         WATCH(bytesRcvd);
         WATCH(bytesSent);
+        data.configure(par("dataCapacity"), par("dataRetention"));
         /* --------------------------------------------------- */
         numRequestsToSend = 0;
         earlySend = false;
@@ -120,42 +121,57 @@ void DFNode::sendBack(cMessage *msg)
 
 void DFNode::handleMessage(cMessage *msg)
 {
-    if (ExperimentControl::getInstance().getSwitchStatus()) {
-        if (msg->getKind() == msg_kind::TIMER || msg->getKind() == msg_kind::INIT_TIMER) {
-            // Set time
-            lastDirectMsgTime = simTime();
-
-            // Schedule next TIMER call
-            cMessage* tmMsg = new cMessage(nullptr, msg_kind::TIMER);
-            scheduleAt(simTime() + frequency, tmMsg);
-
-            // Schedule message to be finally sent after propagation delay
-            EV_INFO << "delayedMsgSend " << simTime();
-            delayedMsgSend(msg, ExperimentControl::getInstance().getState());
-        } else if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-            EV_INFO << "finalMsgSend " << simTime();
-            finalMsgSendRouter(msg, getParentModule()->getName());
-        } else if (msg->getKind() == msg_kind::APP_MSG_RETURNED) {
-            saveData(msg);
-            emit(directArrival, SIMTIME_DBL(simTime()) - SIMTIME_DBL(lastDirectMsgTime));
-            ExperimentControl::getInstance().addDirectStats(lastDirectMsgTime, simTime());
-        } else {
-            handleDirectMessage(msg);
+    // anything else belongs to links still simulated at packet level,
+    // e.g. sensors outside this node's region or the drain before STOP_TCP
+    if (handleParentMessage(msg) || handleChildMessage(msg))
+        return;
+
+    const char *name = getParentModule()->getFullName();
+    if (msg->getKind() == msg_kind::STOP_TCP && ExperimentControl::getInstance().getSwitchStatus(name) && isApplicationLevel(ExperimentControl::getInstance().getState(name))) {
+        // the last reply completes the drain in socketDataArrived()
+        drainPending = true;
+        if (ExperimentControl::getInstance().migratesInFlight()) {
+            // a request still in think time was never sent, finishDrain() cancels its timer
+            tcpMsgTimes = queue<simtime_t>();
+            finishDrain(!migrateInFlight()); // a connection that still carries the migrated reply is not kept
+        } else if (tcpMsgTimes.empty()) {
+            finishDrain();
         }
+        ExperimentControl::getInstance().releaseMessage(msg);
+        return;
+    }
+
+    if (msg->getKind() == msg_kind::BULK_REPLY) {
+        // a whole reply from the parent, modeled as one layer-3 transfer
+        if (socketToMaster)
+            socketDataArrived(socketToMaster, check_and_cast<Packet *>(msg), false);
+        else
+            delete msg;
         return;
     }
 
     if (msg->getKind() == msg_kind::RESTART_TCP) {
-        timeoutMsg->setKind(MSGKIND_CONNECT);
-        scheduleAt(simTime(), timeoutMsg);
-        delete msg;
+        drainPending = false;
+        if (ExperimentControl::getInstance().resumeConnection(name, TcpAppBase::socket.getSocketId())) {
+            // the held connection goes on with the next request of its session
+            tcpMsgTimes.push(simTime());
+            rescheduleOrDeleteTimer(simTime(), MSGKIND_SEND);
+        } else {
+            if (socketToMaster) {
+                // held, but closed or reset during the window
+                socketToMaster->destroy();
+                delete socketToMaster;
+                socketToMaster = nullptr;
+            }
+            timeoutMsg->setKind(MSGKIND_CONNECT);
+            scheduleAt(simTime(), timeoutMsg);
+        }
+        ExperimentControl::getInstance().releaseMessage(msg);
         return;
     }
 
     if (msg->isSelfMessage()) {
-        if (msg->getKind() == msg_kind::TIMER) {
-            delete msg;
-        } else if (msg->getKind() == MSGKIND_CONNECT || msg->getKind() == MSGKIND_SEND) {
+        if (msg->getKind() == MSGKIND_CONNECT || msg->getKind() == MSGKIND_SEND) {
             handleTimer(msg);
         } else {
             sendBack(msg);
@@ -165,6 +181,7 @@ void DFNode::handleMessage(cMessage *msg)
         // we'll close too, but only after there's surely no message
         // pending to be sent back in this connection
         int connId = check_and_cast<Indication *>(msg)->getTag<SocketInd>()->getSocketId();
+        clientHosts.erase(connId);
         delete msg;
         auto request = new Message("close", TCP_C_CLOSE);
         request->addTagIfAbsent<SocketReq>()->setSocketId(connId);
@@ -173,7 +190,7 @@ void DFNode::handleMessage(cMessage *msg)
     else if (msg->getKind() == TCP_I_DATA || msg->getKind() == TCP_I_URGENT_DATA) {
         Packet *packet = check_and_cast<Packet *>(msg);
         int connId = packet->getTag<SocketInd>()->getSocketId();
-        if (connId == 23 || connId == 26 || connId == 37 || connId == 38) {
+        if (connId == TcpAppBase::socket.getSocketId()) { // data from the parent
             if (msg->getKind() == TCP_I_URGENT_DATA) {
                 socketDataArrived(socketToMaster, check_and_cast<Packet *>(msg), true);
             } else {
@@ -205,7 +222,11 @@ void DFNode::handleMessage(cMessage *msg)
                 payload->setExpectedReplyLength(B(0));
                 payload->setReplyDelay(0);
                 outPacket->insertAtBack(payload);
-                sendOrSchedule(outPacket, delay + msgDelay);
+                auto client = clientHosts.find(connId);
+                if (client != clientHosts.end() && ExperimentControl::getInstance().isBulkModeled(getParentModule()->getFullName(), client->second.c_str(), B(requestedBytes).get()))
+                    sendBulkReply(outPacket, client->second, delay + msgDelay);
+                else
+                    sendOrSchedule(outPacket, delay + msgDelay);
             }
             if (appmsg->getServerClose()) {
                 doClose = true;
@@ -225,10 +246,16 @@ void DFNode::handleMessage(cMessage *msg)
         socket.processMessage(msg);
     } else {
         if (msg->getKind() == TCP_I_ESTABLISHED) {
-            if (socketToMaster == nullptr) {
+            int connId = check_and_cast<Indication *>(msg)->getTag<SocketInd>()->getSocketId();
+            if (socketToMaster == nullptr && connId == TcpAppBase::socket.getSocketId()) {
                 socketToMaster = new TcpSocket(msg);
                 socketToMaster->setOutputGate(gate("socketOut"));
                 socketEstablished(socketToMaster);
+            } else if (connId != TcpAppBase::socket.getSocketId()) {
+                // remember which host each accepted connection comes from, for layer-3 replies
+                cModule *client = ExperimentControl::getInstance().findHost(check_and_cast<TcpConnectInfo *>(msg->getControlInfo())->getRemoteAddr());
+                if (client)
+                    clientHosts[connId] = client->getFullName();
             }
             delete msg;
         } else {
@@ -239,32 +266,16 @@ void DFNode::handleMessage(cMessage *msg)
     }
 }
 
-void DFNode::handleDirectMessage(cMessage *msg) {
-    if (msg->getKind() == msg_kind::APP_MSG_SENT) {
-        delete msg;
-        msg = new cMessage(nullptr, msg_kind::APP_SELF_MSG_CLIENT);
-        scheduleAt(simTime() + propagationDelay, msg);
-    } else if (msg->getKind() == msg_kind::APP_SELF_MSG_CLIENT) {
-        msg->setKind(msg_kind::APP_MSG_RETURNED);
-        cModule *targetModule = getModuleByPath("TCPnetworksim.M.app[0]");
-        sendDirect(msg, targetModule, "appIn");
-    } else if (msg->getKind() == msg_kind::STOP_TCP) {
-        if (!tcpMsgTimes.empty()) {
-            scheduleAt(simTime() + 0.01, msg);
-        } else {
-            socketToMaster->destroy();
-            delete socketToMaster;
-            socketToMaster = nullptr;
-            cancelEvent(timeoutMsg);
-            delete msg;
-        }
-    } else if (msg->getKind() == msg_kind::RESTART_TCP) {
-        timeoutMsg->setKind(MSGKIND_CONNECT);
-        scheduleAt(simTime(), timeoutMsg);
-        delete msg;
-    } else {
-        delete msg;
+void DFNode::finishDrain(bool keepConnection) {
+    drainPending = false;
+    if (socketToMaster && (!keepConnection || !ExperimentControl::getInstance().holdConnection(getParentModule()->getFullName(), TcpAppBase::socket.getSocketId()))) {
+        socketToMaster->destroy();
+        delete socketToMaster;
+        socketToMaster = nullptr;
     }
+    cancelEvent(timeoutMsg);
+    clearInFlight();
+    ExperimentControl::getInstance().reportDrained(getParentModule()->getFullName());
 }
 
 void DFNode::refreshDisplay() const
@@ -281,65 +292,9 @@ void DFNode::finish()
     socketToMaster = nullptr;
     EV_INFO << getFullPath() << ": sent " << bytesSent << " bytes in " << msgsSent << " packets\n";
     EV_INFO << getFullPath() << ": received " << bytesRcvd << " bytes in " << msgsRcvd << " packets\n";
-}
-
-void DFNode::saveData(cMessage* msg) {
-    data.push_back("data");
-    delete msg;
-}
-
-void DFNode::delayedMsgSend(cMessage* msg, int layer) {
-    switch (layer) {
-        case 1:
-            if ((msg->isSelfMessage() && msg->getKind() == msg_kind::TIMER) || msg->getKind() == msg_kind::INIT_TIMER) {
-                delete msg;
-                msg = new cMessage(nullptr, msg_kind::APP_SELF_MSG);
-                scheduleAt(simTime() + propagationDelay, msg);
-            } else {
-                error("Must be a self message with kind TIMER or message with kind INIT_TIMER");
-            }
-            break;
-        default:
-            error("Invalid route");
-            break;
-    }
-}
-
-void DFNode::finalMsgSend(cMessage* msg, const char* mod, int layer) {
-    switch (layer) {
-        case 1:
-            if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-                cMessage *tmp = new cMessage(nullptr, msg_kind::APP_MSG_SENT);
-                cModule *targetModule = getModuleByPath(mod);
-                sendDirect(tmp, targetModule, "appIn");
-            } else {
-                error("Must be a self message with kind APP_SELF_MSG");
-            }
-            break;
-        default:
-            error("Invalid route");
-            break;
-    }
-}
-
-void DFNode::finalMsgSendRouter(cMessage* msg, const char* currentMod) {
-    if (!msg->isSelfMessage()) {
-        error("Must be self message");
-    }
-    if (strcmp(currentMod, "DF1") == 0) {
-        for (std::string s : DF1targets) {
-            std::string targetPath("TCPnetworksim." + s + ".app[0]");
-            finalMsgSend(msg, targetPath.c_str(), ExperimentControl::getInstance().getState());
-        }
-    } else if (strcmp(currentMod, "DF2") == 0) {
-        for (std::string s : DF2targets) {
-            std::string targetPath("TCPnetworksim." + s + ".app[0]");
-            finalMsgSend(msg, targetPath.c_str(), ExperimentControl::getInstance().getState());
-        }
-    } else {
-        error("Current module not valid");
-    }
-    delete msg;
+    long numHeld;
+    double age = data.fuse(SIMTIME_ZERO, &numHeld);
+    EV_INFO << getFullPath() << ": holds " << numHeld << " of " << data.getNumReceived() << " readings received, mean age " << age << "s\n";
 }
 
 /* ---------------------------------------------------------------------------------------------- */
@@ -389,6 +344,7 @@ void DFNode::sendRequest()
             << "remaining " << numRequestsToSend - 1 << " request\n";
 
     sendPacket(packet);
+    requestSent();
 }
 
 void DFNode::handleTimer(cMessage *msg)
@@ -448,6 +404,7 @@ void DFNode::rescheduleOrDeleteTimer(simtime_t d, short int msgKind)
 
 void DFNode::socketDataArrived(TcpSocket *socket, Packet *msg, bool urgent)
 {
+    replyArrived(msg->getKind() != msg_kind::BULK_REPLY); // a bulk reply is modeled
     TcpAppBase::socketDataArrived(socket, msg, urgent);
 
     if (!tcpMsgTimes.empty()) {
@@ -458,7 +415,7 @@ void DFNode::socketDataArrived(TcpSocket *socket, Packet *msg, bool urgent)
         tcpMsgTimes.pop();
     }
 
-    if (numRequestsToSend > 0 && !ExperimentControl::getInstance().getSwitchStatus()) {
+    if (numRequestsToSend > 0 && !ExperimentControl::getInstance().isDirectLink(getParentModule()->getFullName())) {
         EV_INFO << "reply arrived\n";
 
         if (timeoutMsg) {
@@ -468,10 +425,16 @@ void DFNode::socketDataArrived(TcpSocket *socket, Packet *msg, bool urgent)
 
         tcpMsgTimes.push(simTime());
     }
+    else if (numRequestsToSend > 0 && drainPending && ExperimentControl::getInstance().keepsConnections()) {
+        EV_INFO << "reply arrived, keeping the connection idle until RESTART_TCP\n";
+    }
     else if (socket->getState() != TcpSocket::LOCALLY_CLOSED) {
         EV_INFO << "reply to last request arrived, closing session\n";
         close();
     }
+
+    if (drainPending && tcpMsgTimes.empty())
+        finishDrain();
 }
 
 void DFNode::close()
@@ -485,7 +448,7 @@ void DFNode::socketClosed(TcpSocket *socket)
     TcpAppBase::socketClosed(socket);
 
     // start another session after a delay
-    if (timeoutMsg && !ExperimentControl::getInstance().getSwitchStatus()) {
+    if (timeoutMsg && !ExperimentControl::getInstance().isDirectLink(getParentModule()->getFullName())) {
         simtime_t d = simTime() + par("idleInterval");
         rescheduleOrDeleteTimer(d, MSGKIND_CONNECT);
     }
@@ -17,6 +17,7 @@
 #define DFNODE_H_
 
 #include "ExperimentControl.h"
+#include "common/DirectRoles.h"
 #include "inet/common/INETDefs.h"
 
 #include "inet/common/lifecycle/LifecycleUnsupported.h"
@@ -34,16 +35,18 @@ using std::queue;
 
 namespace inet {
 
-class DFNode : public TcpAppBase, public LifecycleUnsupported {
+class DFNode : public TcpAppBase, public LifecycleUnsupported,
+        public DirectParentRole<DFNode, TcpDirectTransport>, public DirectChildRole<DFNode, TcpDirectTransport> {
+
+    friend class DirectParentRole<DFNode, TcpDirectTransport>;
+    friend class DirectChildRole<DFNode, TcpDirectTransport>;
 
     private:
         simsignal_t directArrival;
         simsignal_t tcpArrival;
 
     protected:
-        vector<string> data;
-        const vector<string> DF1targets = {"SN1", "SN2"};
-        const vector<string> DF2targets = {"SN3", "SN4"};
+        SensorStore data; // readings received in direct mode
 
         const_simtime_t propagationDelay = 0.1;
         const_simtime_t frequency = 2;
@@ -60,6 +63,7 @@ class DFNode : public TcpAppBase, public LifecycleUnsupported {
         long bytesSent;
 
         std::map<int, ChunkQueue> socketQueue;
+        std::map<int, string> clientHosts; // host behind each accepted connection
         /* -------------------------------------------------------- */
         cMessage *timeoutMsg = nullptr;
         bool earlySend = false;
@@ -67,8 +71,8 @@ class DFNode : public TcpAppBase, public LifecycleUnsupported {
         simtime_t startTime;
         simtime_t stopTime;
 
-        simtime_t lastDirectMsgTime = 0;
         queue<simtime_t> tcpMsgTimes;
+        bool drainPending = false; // STOP_TCP received, waiting for the last reply
 
     public:
         DFNode();
@@ -83,12 +87,6 @@ class DFNode : public TcpAppBase, public LifecycleUnsupported {
         virtual void finish() override;
         virtual void refreshDisplay() const override;
 
-        void saveData(cMessage* msg);
-
-        virtual void delayedMsgSend(cMessage* msg, int layer);
-        virtual void finalMsgSend(cMessage* msg, const char* mod, int layer);
-
-        void finalMsgSendRouter(cMessage* msg, const char* currentMod);
         /* ----------------------------------------------------------------------- */
         virtual void sendRequest();
         virtual void rescheduleOrDeleteTimer(simtime_t d, short int msgKind);
@@ -106,7 +104,7 @@ class DFNode : public TcpAppBase, public LifecycleUnsupported {
 
         virtual void close() override;
 
-        void handleDirectMessage(cMessage *msg);
+        void finishDrain(bool keepConnection = true);
 };
 
 }
@@ -19,22 +19,131 @@ namespace inet {
 
 Define_Module(ExperimentControl);
 
-void ExperimentControl::initialize() {
-    cSimpleModule::initialize();
+Register_Enum(inet::msg_kind, (APP_SELF_MSG, APP_SELF_MSG_CLIENT, APP_MSG_SENT, APP_MSG_RETURNED, INIT_TIMER, TIMER,
+        RESTART_TCP, STOP_TCP, ADAPT_TIMER, START_MSG, END_MSG, BULK_REPLY, MIGRATED_REPLY, FORK_MSG, PARTITION_TOPOLOGY, PARTITION_DRAINED));
 
-    if (!par("hasSwitch")) {
-        sources.clear();
-        targets.clear();
+static const int MAX_RETRANSMISSION_ROUNDS = 12; // as INET's TCP before it gives up on a connection
+
+void ExperimentControl::initialize(int stage) {
+    cSimpleModule::initialize(stage);
+
+    if (stage == INITSTAGE_LAST) {
+        // the application tree is read from resolved addresses, so it is built last
+        getInstance().graph.build(getSimulation()->getSystemModule());
+        getInstance().peers.reset(getSimulation()->getSystemModule(), "tcp");
+        hasSwitch = par("hasSwitch");
+        collectEndpoints();
+
+        partitions.build(this);
+        numTopologies = 0;
+        if (partitions.isPartitioned()) {
+            checkPartitions();
+            // the other replicas learn the links of this partition one lookahead later
+            scheduleAt(SIMTIME_ZERO, new cMessage("partition_topology", msg_kind::PARTITION_TOPOLOGY));
+        }
+
+        prepareLayers();
+        runStart = std::chrono::steady_clock::now();
+        return;
     }
+    if (stage != INITSTAGE_LOCAL)
+        return;
 
     delete tcpMsgStats;
     delete directMsgStats;
     tcpMsgStats = getInstance().tcpMsgStats;
     directMsgStats = getInstance().directMsgStats;
-    setState();
+
+    currentLayer = par("currentLayer");
+    drainTimeout = par("drainTimeout");
+    getInstance().state = currentLayer;
+    getInstance().switchActive = false;
+    getInstance().currentLayer = currentLayer;
+    getInstance().nodeWindow.clear();
+    getInstance().fidelityGeneration++;
+    getInstance().barriers.clear();
+    getInstance().controller = this;
+    InstrumentedScheduler::setFidelityProbe([](const char *host) { return host != nullptr ? getInstance().getState(host) : getInstance().getState(); }, "inet::msg_kind");
+    getInstance().flows.clear();
+    getInstance().messages = new MessagePool("messagePool", par("messagePoolSize").intValue());
+    flowTimer = new cMessage("flow_completion");
+
+    const char *delayModel = par("delayModel");
+    if (strcmp(delayModel, "calibrated") == 0)
+        getInstance().calibrateDelays = true;
+    else if (strcmp(delayModel, "constant") == 0)
+        getInstance().calibrateDelays = false;
+    else
+        throw cRuntimeError("Unknown delayModel \"%s\"", delayModel);
+    getInstance().delays.configure(par("delaySamples").intValue(), par("minDelaySamples").intValue());
+    getInstance().directLoss = par("directLoss");
+    getInstance().directJitter = par("directJitter");
+    getInstance().directBatching = par("directBatching");
+    getInstance().batches.clear();
+    getInstance().retransmissionTimeout = par("directRetransmissionTimeout");
+    getInstance().directRetransmissions = 0;
+    getInstance().bypassBusyUntil.clear();
+    getInstance().bulkThreshold = par("bulkThreshold").intValue();
+    getInstance().connectionHandoff = par("connectionHandoff");
+    getInstance().migrateInFlight = par("migrateInFlight");
+    getInstance().migratedReplies = 0;
+    getInstance().handoffs.clear();
+
+    const char *mode = par("mode");
+    if (strcmp(mode, "adaptive") == 0) {
+        adaptive = true;
+        if (par("forkAt").doubleValue() >= 0)
+            throw cRuntimeError("forkAt needs mode = \"schedule\"");
+        adaptiveLayer = par("adaptiveLayer");
+        wallClockBudget = par("wallClockBudget");
+        headroomFactor = par("headroomFactor");
+        minDwellTime = par("minDwellTime");
+        accuracyCheckInterval = par("accuracyCheckInterval");
+        accuracyCheckDuration = par("accuracyCheckDuration");
+        if (adaptiveLayer < 0 || adaptiveLayer > 3)
+            throw cRuntimeError("Layer %d is not supported by the TCP network", adaptiveLayer);
+        regions.parse(par("regions"));
+        adaptiveWindow.region = par("adaptiveRegion").stdstringValue();
+        if (!regions.has(adaptiveWindow.region))
+            throw cRuntimeError("Unknown adaptiveRegion \"%s\"", adaptiveWindow.region.c_str());
+        if (headroomFactor > 1)
+            throw cRuntimeError("headroomFactor must not exceed 1");
+        // no further switch is taken while a drain is pending, so it must end
+        if (drainTimeout < SIMTIME_ZERO)
+            throw cRuntimeError("mode = \"adaptive\" needs a non-negative drainTimeout");
+    } else if (strcmp(mode, "schedule") == 0) {
+        readSchedule();
+        setState();
+        forkAt = par("forkAt");
+        if (forkAt >= SIMTIME_ZERO)
+            scheduleFork();
+    } else {
+        throw cRuntimeError("Unknown mode \"%s\"", mode);
+    }
+
+    clockSampleInterval = par("clockSampleInterval");
+    wallTimes.setName("wallTimes");
+    cpuTimes.setName("cpuTimes");
+    eventCounts.setName("eventCounts");
+    InstrumentedScheduler *scheduler = dynamic_cast<InstrumentedScheduler *>(getSimulation()->getScheduler());
+    if (scheduler != nullptr && clockSampleInterval > SIMTIME_ZERO)
+        scheduler->sampleClock(this, clockSampleInterval);
+    else if (adaptive)
+        throw cRuntimeError("mode = \"adaptive\" needs scheduler-class = \"inet::InstrumentedScheduler\" and a positive clockSampleInterval");
+    if (adaptive) {
+        adaptTimer = new cMessage("adapt_timer", msg_kind::ADAPT_TIMER);
+        scheduleAt(SIMTIME_ZERO, adaptTimer);
+    }
 }
 
 ExperimentControl::~ExperimentControl() {
+    cancelAndDelete(flowTimer);
+    cancelAndDelete(adaptTimer);
+    if (getInstance().controller == this) {
+        delete getInstance().messages;
+        getInstance().messages = nullptr;
+        getInstance().controller = nullptr;
+    }
     delete tcpMsgStats;
     delete directMsgStats;
     tcpMsgStats = nullptr;
@@ -42,33 +151,232 @@ ExperimentControl::~ExperimentControl() {
 }
 
 void ExperimentControl::handleMessage(cMessage* msg) {
-    if (msg->getKind() == msg_kind::START_MSG && msg->isSelfMessage()) {
-        this->state = newLayer;
-        getInstance().switchActive = true;
+    const FidelityWindow *window = static_cast<const FidelityWindow *>(msg->getContextPointer());
+    if (msg == flowTimer) {
+        deliverFlows();
+    } else if (msg == adaptTimer) {
+        // the scheduler sampled the clocks just before this event
+        adaptFidelity(lastClock.wallTime);
+        scheduleAt(simTime() + clockSampleInterval, adaptTimer);
+    } else if (msg->getKind() == msg_kind::START_MSG && msg->isSelfMessage()) {
+        enterWindow(*window);
         delete msg;
     } else if (msg->getKind() == msg_kind::END_MSG && msg->isSelfMessage()) {
-        this->state = currentLayer;
-        getInstance().switchActive = false;
+        leaveWindow(*window);
+        transitionPending = false;
+        delete msg;
+    } else if (msg->getKind() == msg_kind::FORK_MSG && msg->isSelfMessage()) {
         delete msg;
-        msg = new cMessage("restart_tcp", msg_kind::RESTART_TCP);
-        sendToTargets(msg);
+        forkBranches();
+    } else if (msg->getKind() == msg_kind::PARTITION_TOPOLOGY && msg->isSelfMessage()) {
         delete msg;
+        sendTopology();
+    } else if (msg->arrivedOn("peerIn")) {
+        receiveFromPartition(msg);
     } else if (msg->getKind() == msg_kind::INIT_TIMER && msg->isSelfMessage()) {
-        if (!getInstance().getSwitchStatus() && simTime() < end_time) {
-            // to make sure timeout arrives after route has been switched
-            scheduleAt(simTime() + 0.01, msg);
-        } else {
-            cMessage* stopMsg = new cMessage("stop_tcp", msg_kind::STOP_TCP);
-            sendToTargets(stopMsg);
-            sendToSources(msg);
-            delete stopMsg;
-            delete msg;
-        }
+        // drain deadline passed
+        drainDeadlines.erase(window);
+        delete msg;
+        EV_WARN << "targets of the window starting at " << window->start << " did not drain within " << drainTimeout << ", switching anyway" << endl;
+        commitWindow(*window);
     } else {
         delete msg;
     }
 }
 
+cMessage *ExperimentControl::acquireMessage(const char *name, short kind) {
+    MessagePool *pool = getInstance().messages;
+    return pool ? pool->acquire(name, kind) : new cMessage(name, kind);
+}
+
+void ExperimentControl::releaseMessage(cMessage *msg) {
+    MessagePool *pool = getInstance().messages;
+    if (pool)
+        pool->release(msg);
+    else
+        delete msg;
+}
+
+bool ExperimentControl::isBatched(const char *node) const {
+    return getInstance().directBatching && getState(node) == 1;
+}
+
+void ExperimentControl::postDirect(const char *node, int source, simtime_t sent, simtime_t arrival) {
+    getInstance().batches.post(getParent(node), source, sent, arrival);
+}
+
+vector<DirectRecord> ExperimentControl::collectDirect(const char *node) {
+    return getInstance().batches.collect(node, simTime());
+}
+
+void ExperimentControl::sendFlow(const char *from, const char *to, cMessage *msg) {
+    getInstance().controller->startFlowTransfer(from, to, msg);
+}
+
+void ExperimentControl::startFlowTransfer(const char *from, const char *to, cMessage *msg) {
+    Enter_Method_Silent();
+    take(msg);
+    const RoutingGraph& graph = getInstance().graph;
+    bool up = graph.hasParent(from) && graph.getParent(from) == to;
+    string host = up ? from : to;
+    const DirectRoute& route = graph.getRoute(host);
+    getInstance().flows.add(simTime(), from, to, up ? route.up : route.down, 8 * getInstance().links.getMessageBytes(host, up), msg);
+    scheduleFlowTimer();
+}
+
+void ExperimentControl::deliverFlows() {
+    for (const FlowEngine::Delivery& delivery : getInstance().flows.collect(simTime())) {
+        const DirectPeer& peer = getPeer(delivery.destination);
+        sendDirect(delivery.msg, delivery.propagationDelay, 0, peer.app, peer.appInGateId);
+    }
+    scheduleFlowTimer();
+}
+
+void ExperimentControl::scheduleFlowTimer() {
+    cancelEvent(flowTimer);
+    simtime_t next = getInstance().flows.getNextCompletion();
+    if (next >= SIMTIME_ZERO)
+        scheduleAt(std::max(next, simTime()), flowTimer);
+}
+
+void ExperimentControl::enterWindow(const FidelityWindow& window) {
+    if (partitions.isPartitioned() && numTopologies < partitions.getNumPartitions() - 1)
+        throw cRuntimeError("The window at %s starts before all partitions have reported their links, one lookahead into the run", window.start.str().c_str());
+    getInstance().fidelityGeneration++;
+    // the other end of a link may be a host of another partition
+    auto enter = [&](const string& node) {
+        if (regions.contains(window.region, node))
+            getInstance().nodeWindow[node] = &window;
+    };
+    for (const string& node : sources) {
+        enter(node);
+        for (const string& child : getChildren(node.c_str()))
+            enter(child);
+    }
+    for (const string& node : targets) {
+        enter(node);
+        enter(getParent(node.c_str()));
+    }
+    activeWindows.insert(&window);
+    getInstance().state = window.layer;
+    getInstance().switchActive = true;
+
+    // layers 2 and 3 keep the applications and TCP running; BypassTcp and the
+    // servers read the window per segment or reply
+    if (window.layer == 2 || window.layer == 3) {
+        transitionPending = false;
+        return;
+    }
+
+    // targets stop issuing requests and report back once the last reply arrived
+    WindowBarrier& barrier = getInstance().barriers[&window];
+    barrier = WindowBarrier();
+    barrier.numNodes = getWindowTargets(window).size();
+    cMessage* stopMsg = acquireMessage("stop_tcp", msg_kind::STOP_TCP);
+    sendToTargets(stopMsg, window);
+    releaseMessage(stopMsg);
+
+    if (drainTimeout >= SIMTIME_ZERO) {
+        cMessage *deadline = new cMessage("drain_timeout", msg_kind::INIT_TIMER);
+        deadline->setContextPointer(const_cast<FidelityWindow *>(&window));
+        drainDeadlines[&window] = deadline;
+        scheduleAt(simTime() + drainTimeout, deadline);
+    }
+    checkBarrier(window);
+}
+
+void ExperimentControl::reportDrained(const char *node) {
+    auto window = getInstance().nodeWindow.find(node);
+    if (window != getInstance().nodeWindow.end() && getInstance().controller)
+        getInstance().controller->windowDrained(*window->second);
+}
+
+bool ExperimentControl::holdConnection(const char *node, int socketId) {
+    if (!getInstance().connectionHandoff)
+        return false;
+    return getInstance().handoffs.hold(getSimulation()->getSystemModule()->getModuleByPath(("." + string(node)).c_str()), socketId);
+}
+
+bool ExperimentControl::resumeConnection(const char *node, int socketId) {
+    if (!getInstance().connectionHandoff)
+        return false;
+    return getInstance().handoffs.resume(getSimulation()->getSystemModule()->getModuleByPath(("." + string(node)).c_str()), socketId);
+}
+
+bool ExperimentControl::getMigratedArrival(const char *node, simtime_t sent, simtime_t fallback, simtime_t& arrival) {
+    getInstance().migratedReplies++;
+    arrival = std::max(sent + getParentDelay(node, fallback) * 2, simTime());
+    arrival += getTransferPenalty(node, true) + getTransferPenalty(node, false);
+    return true;
+}
+
+void ExperimentControl::windowDrained(const FidelityWindow& window) {
+    Enter_Method_Silent();
+    getInstance().barriers[&window].numNodesReady++;
+    checkBarrier(window);
+}
+
+void ExperimentControl::checkBarrier(const FidelityWindow& window) {
+    WindowBarrier& barrier = getInstance().barriers[&window];
+    if (barrier.committed || barrier.numNodesReady < barrier.numNodes)
+        return;
+    if (!barrier.reported && partitions.isPartitioned()) {
+        barrier.reported = true;
+        for (int i = 0; i < gateSize("peerOut"); i++) {
+            cMessage *msg = new cMessage("partition_drained", msg_kind::PARTITION_DRAINED);
+            msg->addPar("window") = (long)(&window - &schedule[0]);
+            send(msg, "peerOut", i);
+        }
+    }
+    if (barrier.numPartitionsReady >= partitions.getNumPartitions() - 1)
+        commitWindow(window);
+}
+
+void ExperimentControl::commitWindow(const FidelityWindow& window) {
+    // the adaptive mode may switch again once the drain is over, or timed out
+    transitionPending = false;
+    transitionLatency.collect(simTime() - window.start);
+    getInstance().fidelityGeneration++;
+    getInstance().barriers[&window].committed = true;
+    auto deadline = drainDeadlines.find(&window);
+    if (deadline != drainDeadlines.end()) {
+        cancelAndDelete(deadline->second);
+        drainDeadlines.erase(deadline);
+    }
+
+    cMessage *initMsg = acquireMessage("timeout", msg_kind::INIT_TIMER);
+    sendToSources(initMsg, window);
+    releaseMessage(initMsg);
+}
+
+void ExperimentControl::leaveWindow(const FidelityWindow& window) {
+    getInstance().fidelityGeneration++;
+    for (auto it = getInstance().nodeWindow.begin(); it != getInstance().nodeWindow.end(); ) {
+        if (it->second == &window)
+            it = getInstance().nodeWindow.erase(it);
+        else
+            ++it;
+    }
+    activeWindows.erase(&window);
+    getInstance().switchActive = !activeWindows.empty();
+    if (!getInstance().switchActive)
+        getInstance().state = currentLayer;
+
+    getInstance().barriers.erase(&window);
+    auto deadline = drainDeadlines.find(&window);
+    if (deadline != drainDeadlines.end()) {
+        cancelAndDelete(deadline->second);
+        drainDeadlines.erase(deadline);
+    }
+
+    if (window.layer == 2 || window.layer == 3)
+        return;
+
+    cMessage *restartMsg = acquireMessage("restart_tcp", msg_kind::RESTART_TCP);
+    sendToTargets(restartMsg, window);
+    releaseMessage(restartMsg);
+}
+
 int ExperimentControl::getState() const {
     return getInstance().state;
 }
@@ -77,27 +385,438 @@ bool ExperimentControl::getSwitchStatus() const {
     return getInstance().switchActive;
 }
 
+int ExperimentControl::getState(const char *node) const {
+    auto it = getInstance().nodeWindow.find(node);
+    return it != getInstance().nodeWindow.end() ? it->second->layer : getInstance().currentLayer;
+}
+
+bool ExperimentControl::getSwitchStatus(const char *node) const {
+    return getInstance().nodeWindow.count(node) > 0;
+}
+
+const DirectPeer& ExperimentControl::getPeer(const string& host) {
+    return getInstance().peers.get(host);
+}
+
+void ExperimentControl::sendToPartition(const DirectPeer& peer, cMessage *msg, simtime_t delay) {
+    getInstance().controller->forwardToPartition(peer, msg, delay);
+}
+
+void ExperimentControl::forwardToPartition(const DirectPeer& peer, cMessage *msg, simtime_t delay) {
+    Enter_Method_Silent();
+    take(msg);
+    int gate = partitions.getGate(peer.host);
+    if (delay < partitions.getLookahead(gate))
+        throw cRuntimeError("Direct message to %s is due in %s, less than the lookahead %s towards its partition",
+                peer.host->getFullName(), delay.str().c_str(), partitions.getLookahead(gate).str().c_str());
+    // the receiving controller delivers it at the timestamp
+    msg->setName(peer.host->getFullName());
+    msg->setTimestamp(simTime() + delay);
+    send(msg, "peerOut", gate);
+}
+
+void ExperimentControl::receiveFromPartition(cMessage *msg) {
+    if (msg->getKind() == msg_kind::PARTITION_TOPOLOGY) {
+        cArray& links = msg->getParList();
+        for (int i = 0; i < links.size(); i++) {
+            cMsgPar *link = check_and_cast<cMsgPar *>(links[i]);
+            getInstance().graph.addRemoteLink(link->getName(), link->stringValue());
+        }
+        numTopologies++;
+        collectEndpoints();
+        delete msg;
+    } else if (msg->getKind() == msg_kind::PARTITION_DRAINED) {
+        const FidelityWindow& window = schedule[msg->par("window").longValue()];
+        delete msg;
+        // a window shorter than the lookahead may be over by now
+        if (activeWindows.count(&window)) {
+            getInstance().barriers[&window].numPartitionsReady++;
+            checkBarrier(window);
+        }
+    } else {
+        // a direct message for a local app
+        const DirectPeer& peer = getPeer(msg->getName());
+        simtime_t arrival = msg->getTimestamp();
+        msg->setName(nullptr);
+        msg->setTimestamp(SIMTIME_ZERO);
+        sendDirect(msg, arrival - simTime(), 0, peer.app, peer.appInGateId);
+    }
+}
+
+void ExperimentControl::sendTopology() {
+    const RoutingGraph& graph = getInstance().graph;
+    cMessage *msg = new cMessage("partition_topology", msg_kind::PARTITION_TOPOLOGY);
+    for (const auto& link : graph.getParents()) {
+        if (graph.hasRoute(link.first)) // child in this partition
+            msg->addPar(link.first.c_str()) = link.second.c_str();
+    }
+    for (int i = 0; i < gateSize("peerOut"); i++)
+        send(i == gateSize("peerOut") - 1 ? msg : msg->dup(), "peerOut", i);
+}
+
+void ExperimentControl::collectEndpoints() {
+    const RoutingGraph& graph = getInstance().graph;
+    sources.clear();
+    targets.clear();
+    if (!hasSwitch)
+        return;
+    for (const string& host : graph.getHosts()) {
+        if (!graph.getChildren(host).empty())
+            sources.push_back(host);
+        if (graph.hasParent(host))
+            targets.push_back(host);
+    }
+    // resolve the endpoints of all hosts taking part in switches up front
+    for (const vector<string> *nodes : {&sources, &targets}) {
+        for (const string& node : *nodes)
+            getPeer(node);
+    }
+}
+
+void ExperimentControl::checkPartitions() const {
+    if (adaptive)
+        throw cRuntimeError("mode = \"adaptive\" cannot run in parallel, each partition would follow its own wall clock");
+    if (forkAt >= SIMTIME_ZERO)
+        throw cRuntimeError("forkAt cannot be used in a parallel run");
+    if (getInstance().directBatching)
+        throw cRuntimeError("directBatching collects the answers at the parent's controller and cannot run in parallel");
+    if (getInstance().directLoss || getInstance().directJitter)
+        throw cRuntimeError("directLoss and directJitter need both directions of a link in one partition and cannot run in parallel");
+
+    // only layer 1 carries messages between partitions, through the controllers
+    cModule *network = getSimulation()->getSystemModule();
+    for (const string& host : targets) {
+        cModule *parent = network->getModuleByPath(("." + getParent(host.c_str())).c_str());
+        if (!parent->isPlaceholder())
+            continue;
+        for (size_t i = 0; i < schedule.size(); i++) {
+            const FidelityWindow& window = schedule[i];
+            if (window.layer != currentLayer && window.layer != 1 && regions.contains(window.region, host) && regions.contains(window.region, parent->getFullName()))
+                throw cRuntimeError("The window at %s switches the link from %s to %s, which crosses partitions, to layer %d; only layer 1 can cross partitions",
+                        window.start.str().c_str(), host.c_str(), parent->getFullName(), window.layer);
+        }
+    }
+}
+
+const string& ExperimentControl::getParent(const char *node) const {
+    return getInstance().graph.getParent(node);
+}
+
+const vector<string>& ExperimentControl::getChildren(const char *node) const {
+    return getInstance().graph.getChildren(node);
+}
+
+simtime_t ExperimentControl::getParentDelay(const char *node, simtime_t fallback) {
+    if (!getInstance().calibrateDelays)
+        return fallback;
+    return getInstance().delays.sample(node, getParent(node), fallback, getInstance().controller->getRNG(0));
+}
+
+simtime_t ExperimentControl::getChildDelay(const char *node, simtime_t fallback) {
+    if (!getInstance().calibrateDelays)
+        return fallback;
+    vector<const string*> directChildren;
+    for (const string& child : getChildren(node)) {
+        if (isDirectLink(child.c_str()))
+            directChildren.push_back(&child);
+    }
+    if (directChildren.empty())
+        return fallback;
+    cRNG *rng = getInstance().controller->getRNG(0);
+    const string& child = *directChildren[intuniform(rng, 0, directChildren.size() - 1)];
+    return getInstance().delays.sample(node, child, fallback, rng);
+}
+
+cModule *ExperimentControl::findHost(const L3Address& address) {
+    return getInstance().graph.findHost(address);
+}
+
+bool ExperimentControl::isLinkInWindow(const char *node, const char *peer, int layer) const {
+    const std::map<string, const FidelityWindow*>& nodeWindow = getInstance().nodeWindow;
+    auto window = nodeWindow.find(node);
+    auto peerWindow = nodeWindow.find(peer);
+    if (window == nodeWindow.end() || peerWindow == nodeWindow.end() || window->second != peerWindow->second || window->second->layer != layer)
+        return false;
+    const std::map<string, string>& parents = getInstance().graph.getParents();
+    auto parent = parents.find(node);
+    auto peerParent = parents.find(peer);
+    return (parent != parents.end() && parent->second == peer) || (peerParent != parents.end() && peerParent->second == node);
+}
+
+bool ExperimentControl::isBypassed(const char *node, const char *peer) const {
+    return getInstance().isLinkInWindow(node, peer, 2);
+}
+
+bool ExperimentControl::isBulkModeled(const char *server, const char *client, int64_t bytes) const {
+    return bytes >= getInstance().bulkThreshold && getInstance().isLinkInWindow(server, client, 3);
+}
+
+simtime_t ExperimentControl::getBulkCompletionTime(const char *server, const char *client, int64_t bytes) const {
+    const RoutingGraph& graph = getInstance().graph;
+    bool up = graph.hasParent(server) && graph.getParent(server) == client;
+    return getInstance().bulkTransfers.getCompletionTime(up ? server : client, up, bytes);
+}
+
+bool ExperimentControl::getBypassDelay(const char *node, const char *peer, int64_t bits, simtime_t& delay) {
+    ExperimentControl& instance = getInstance();
+    bool up = instance.graph.hasParent(node) && instance.graph.getParent(node) == peer;
+    const DirectRoute& route = instance.graph.getRoute(up ? node : peer);
+    cRNG *rng = instance.controller->getRNG(0);
+
+    // store and forward over every channel, queueing behind segments already on it
+    simtime_t arrival = simTime();
+    for (cDatarateChannel *channel : up ? route.up : route.down) {
+        if (!channel)
+            continue;
+        simtime_t& busyUntil = instance.bypassBusyUntil[channel];
+        if (busyUntil < arrival)
+            busyUntil = arrival;
+        if (channel->getDatarate() > 0)
+            busyUntil += bits / channel->getDatarate();
+        arrival = busyUntil + channel->getDelay();
+        if (channel->getPacketErrorRate() > 0 && uniform(rng, 0, 1) < channel->getPacketErrorRate())
+            return false;
+    }
+    delay = arrival - simTime();
+    return true;
+}
+
+simtime_t ExperimentControl::getTransferPenalty(const char *node, bool up) {
+    ExperimentControl& instance = getInstance();
+    cRNG *rng = instance.controller->getRNG(0);
+    simtime_t penalty = 0;
+    if (instance.directJitter)
+        penalty += instance.links.sampleJitter(node, up, rng);
+    if (instance.directLoss) {
+        // lost segments are resent after a timeout that doubles every round, like TCP's RTO backoff
+        simtime_t timeout = instance.retransmissionTimeout;
+        int lost = instance.links.sampleLostPackets(node, up, instance.links.getNumPackets(node, up), rng);
+        for (int round = 0; lost > 0 && round < MAX_RETRANSMISSION_ROUNDS; round++) {
+            instance.directRetransmissions += lost;
+            penalty += timeout;
+            timeout *= 2;
+            lost = instance.links.sampleLostPackets(node, up, lost, rng);
+        }
+    }
+    return penalty;
+}
+
+bool ExperimentControl::isDirectLink(const char *node) const {
+    const std::map<string, const FidelityWindow*>& nodeWindow = getInstance().nodeWindow;
+    auto parent = getInstance().graph.getParents().find(node);
+    if (parent == getInstance().graph.getParents().end())
+        return false;
+    auto window = nodeWindow.find(node);
+    auto parentWindow = nodeWindow.find(parent->second);
+    return window != nodeWindow.end() && parentWindow != nodeWindow.end() && window->second == parentWindow->second && isApplicationLevel(window->second->layer);
+}
+
 void ExperimentControl::setState() {
-    if (currentLayer == newLayer) return;
-    cMessage* startMsg = new cMessage("start_msg", msg_kind::START_MSG);
-    cMessage* endMsg = new cMessage("end_msg", msg_kind::END_MSG);
-    cMessage* timeout = new cMessage("timeout", msg_kind::INIT_TIMER);
-    scheduleAt(start_time, startMsg);
-    scheduleAt(end_time, endMsg);
-    scheduleAt(start_time, timeout);
+    for (size_t i = 0; i < schedule.size(); i++) {
+        const FidelityWindow& window = schedule[i];
+        // windows that keep the current fidelity need no transition
+        if (window.layer == currentLayer)
+            continue;
+        scheduleTransition("start_msg", msg_kind::START_MSG, window.start, window);
+        scheduleTransition("end_msg", msg_kind::END_MSG, window.end, window);
+    }
+}
+
+void ExperimentControl::scheduleTransition(const char *name, short int kind, simtime_t time, const FidelityWindow& window) {
+    cMessage *msg = new cMessage(name, kind);
+    msg->setContextPointer(const_cast<FidelityWindow *>(&window));
+    scheduleAt(time, msg);
 }
 
-void ExperimentControl::sendToSources(cMessage *msg) {
-    for (std::string s : sources) {
-        std::string targetPath("TCPnetworksim." + s + ".app[0]");
-        sendDirect(new cMessage(nullptr, msg->getKind()), getModuleByPath(targetPath.c_str()), "appIn");
+void ExperimentControl::scheduleFork() {
+    if (ForkPoint::parseBranches(par("forkSchedules")).empty())
+        throw cRuntimeError("forkAt is set, but forkSchedules has no branch");
+    for (size_t i = 0; i < schedule.size(); i++) {
+        if (schedule[i].start < forkAt && forkAt < schedule[i].end)
+            throw cRuntimeError("forkAt %s lies inside the window %s..%s, the branches must start at full fidelity",
+                    forkAt.str().c_str(), schedule[i].start.str().c_str(), schedule[i].end.str().c_str());
     }
+    cMessage *msg = new cMessage("fork", msg_kind::FORK_MSG);
+    msg->setSchedulingPriority(-1); // before the transitions at the same time
+    scheduleAt(forkAt, msg);
 }
 
-void ExperimentControl::sendToTargets(cMessage *msg) {
-    for (std::string s : targets) {
-        std::string targetPath("TCPnetworksim." + s + ".app[0]");
-        sendDirect(new cMessage(nullptr, msg->getKind()), getModuleByPath(targetPath.c_str()), "appIn");
+void ExperimentControl::forkBranches() {
+    vector<string> branches = ForkPoint::parseBranches(par("forkSchedules"));
+    int branch = forks.fork(branches.size(), par("forkDirectory"));
+    if (branch == 0) {
+        EV_INFO << "forked " << branches.size() << " branches, continuing with fidelitySchedule" << endl;
+        return;
+    }
+
+    // windows that have not started yet are replaced by those of the branch; a window
+    // ending right here keeps its END_MSG
+    std::set<void *> replaced;
+    vector<cMessage *> transitions;
+    cFutureEventSet *fes = getSimulation()->getFES();
+    for (int i = 0; i < fes->getLength(); i++) {
+        cMessage *msg = dynamic_cast<cMessage *>(fes->get(i));
+        if (!msg || msg->getArrivalModule() != this)
+            continue;
+        if (msg->getKind() == msg_kind::START_MSG)
+            replaced.insert(msg->getContextPointer());
+        if (msg->getKind() == msg_kind::START_MSG || msg->getKind() == msg_kind::END_MSG)
+            transitions.push_back(msg);
+    }
+    for (cMessage *msg : transitions) {
+        if (replaced.count(msg->getContextPointer()))
+            cancelAndDelete(msg);
+    }
+
+    branchSchedule.parse(branches[branch - 1].c_str());
+    branchSchedule.validate(regions);
+    checkLayers(branchSchedule);
+    for (size_t i = 0; i < branchSchedule.size(); i++) {
+        const FidelityWindow& window = branchSchedule[i];
+        if (window.start < simTime())
+            throw cRuntimeError("Branch %d has a window starting at %s, before the fork", branch, window.start.str().c_str());
+        if (window.layer == currentLayer)
+            continue;
+        scheduleTransition("start_msg", msg_kind::START_MSG, window.start, window);
+        scheduleTransition("end_msg", msg_kind::END_MSG, window.end, window);
+    }
+    prepareLayers();
+    EV_INFO << "continuing as branch " << branch << " with \"" << branches[branch - 1] << "\"" << endl;
+}
+
+void ExperimentControl::clockSampled(const InstrumentedScheduler::ClockSample& sample) {
+    Enter_Method_Silent();
+    lastClock = sample;
+    wallTimes.recordWithTimestamp(sample.time, sample.wallTime);
+    cpuTimes.recordWithTimestamp(sample.time, sample.cpuTime);
+    eventCounts.recordWithTimestamp(sample.time, sample.events);
+}
+
+void ExperimentControl::adaptFidelity(double elapsed) {
+    Enter_Method_Silent();
+    if (!adaptive || transitionPending || simTime() <= SIMTIME_ZERO)
+        return;
+
+    // hysteresis: stay at a level for at least minDwellTime
+    if (simTime() - lastSwitchTime < minDwellTime)
+        return;
+
+    // cumulative ratio, so that the whole run stays within budget * sim-time-limit
+    double ratio = elapsed / SIMTIME_DBL(simTime());
+    if (!getSwitchStatus()) {
+        if (ratio > wallClockBudget && simTime() >= accuracyCheckUntil) {
+            EV_INFO << "wall-clock ratio " << ratio << " over budget " << wallClockBudget << ", switching to layer " << adaptiveLayer << endl;
+            beginAbstraction(adaptiveLayer);
+        }
+    } else if (accuracyCheckInterval >= SIMTIME_ZERO && simTime() - lastSwitchTime >= accuracyCheckInterval) {
+        EV_INFO << "accuracy check, returning to layer " << currentLayer << " for " << accuracyCheckDuration << endl;
+        accuracyCheckUntil = simTime() + accuracyCheckDuration;
+        endAbstraction();
+    } else if (ratio < wallClockBudget * headroomFactor) {
+        EV_INFO << "wall-clock ratio " << ratio << " has headroom, returning to layer " << currentLayer << endl;
+        endAbstraction();
+    }
+}
+
+void ExperimentControl::beginAbstraction(int layer) {
+    adaptiveWindow.start = simTime();
+    adaptiveWindow.end = SimTime::getMaxTime();
+    adaptiveWindow.layer = layer;
+    lastSwitchTime = simTime();
+    transitionPending = true;
+    scheduleTransition("start_msg", msg_kind::START_MSG, simTime(), adaptiveWindow);
+}
+
+void ExperimentControl::endAbstraction() {
+    lastSwitchTime = simTime();
+    transitionPending = true;
+    scheduleTransition("end_msg", msg_kind::END_MSG, simTime(), adaptiveWindow);
+}
+
+void ExperimentControl::readSchedule() {
+    regions.parse(par("regions"));
+
+    cXMLElement *scheduleFile = par("fidelityScheduleFile").xmlValue();
+    if (scheduleFile && scheduleFile->hasChildren()) {
+        schedule.parse(scheduleFile);
+    } else {
+        schedule.parse(par("fidelitySchedule").stringValue());
+    }
+    schedule.validate(regions);
+    checkLayers(schedule);
+}
+
+void ExperimentControl::checkLayers(const FidelitySchedule& windows) const {
+    for (size_t i = 0; i < windows.size(); i++) {
+        if (windows[i].layer != currentLayer && (windows[i].layer < 0 || windows[i].layer > 3)) {
+            throw cRuntimeError("Layer %d is not supported by the TCP network", windows[i].layer);
+        }
+    }
+}
+
+void ExperimentControl::prepareLayers() {
+    const RoutingGraph& graph = getInstance().graph;
+    if (getInstance().directLoss || getInstance().directJitter || usesLayer(0))
+        getInstance().links.build(getSimulation()->getSystemModule(), graph);
+    if (usesLayer(3))
+        getInstance().bulkTransfers.build(getSimulation()->getSystemModule(), graph);
+    if (usesLayer(2)) {
+        for (const string& host : graph.getHosts()) {
+            cModule *tcp = getSimulation()->getSystemModule()->getModuleByPath(("." + host + ".tcp").c_str());
+            if (!tcp || !tcp->hasGate("bypassIn"))
+                throw cRuntimeError("Layer 2 needs BypassTcp on every host, %s has none (set **.tcp.typename = \"BypassTcp\")", host.c_str());
+        }
+    }
+}
+
+bool ExperimentControl::usesLayer(int layer) const {
+    if (adaptive)
+        return adaptiveLayer == layer;
+    for (const FidelitySchedule *windows : {&schedule, &branchSchedule}) {
+        for (size_t i = 0; i < windows->size(); i++) {
+            if ((*windows)[i].layer == layer)
+                return true;
+        }
+    }
+    return false;
+}
+
+vector<string> ExperimentControl::getWindowTargets(const FidelityWindow& window) const {
+    vector<string> windowTargets;
+    for (const string& s : targets) {
+        if (regions.contains(window.region, s) && regions.contains(window.region, getParent(s.c_str())))
+            windowTargets.push_back(s);
+    }
+    return windowTargets;
+}
+
+vector<string> ExperimentControl::getWindowSources(const FidelityWindow& window) const {
+    // the children need not be local
+    vector<string> windowSources;
+    for (const string& s : sources) {
+        if (!regions.contains(window.region, s))
+            continue;
+        for (const string& child : getChildren(s.c_str())) {
+            if (regions.contains(window.region, child)) {
+                windowSources.push_back(s);
+                break;
+            }
+        }
+    }
+    return windowSources;
+}
+
+void ExperimentControl::sendToSources(cMessage *msg, const FidelityWindow& window) {
+    for (std::string s : getWindowSources(window)) {
+        const DirectPeer& peer = getPeer(s);
+        sendDirect(acquireMessage(nullptr, msg->getKind()), peer.app, peer.appInGateId);
+    }
+}
+
+void ExperimentControl::sendToTargets(cMessage *msg, const FidelityWindow& window) {
+    for (std::string s : getWindowTargets(window)) {
+        const DirectPeer& peer = getPeer(s);
+        sendDirect(acquireMessage(nullptr, msg->getKind()), peer.app, peer.appInGateId);
     }
 }
 
@@ -105,11 +824,25 @@ void ExperimentControl::addTcpStats(simtime_t previousTime, simtime_t currentTim
     tcpMsgStats->collect(SIMTIME_DBL(currentTime) - SIMTIME_DBL(previousTime));
 }
 
+void ExperimentControl::addRoundTrip(const char *node, simtime_t sent, simtime_t arrival) {
+    // only what the packet-level model measured, not a window's abstractions
+    if (getInstance().calibrateDelays && !getSwitchStatus(node))
+        getInstance().delays.collect(node, getParent(node), SIMTIME_DBL(arrival) - SIMTIME_DBL(sent), getInstance().controller->getRNG(0));
+}
+
 void ExperimentControl::addDirectStats(simtime_t previousTime, simtime_t currentTime) {
     directMsgStats->collect(SIMTIME_DBL(currentTime) - SIMTIME_DBL(previousTime));
 }
 
 void ExperimentControl::finish() {
+    // merged over replications by simulations/replicate.py
+    recordStatistic(getInstance().tcpMsgStats);
+    recordStatistic(getInstance().directMsgStats);
+    recordStatistic(&transitionLatency);
+    recordScalar("events", getSimulation()->getEventNumber());
+    recordScalar("simulatedTime", simTime(), "s");
+    recordScalar("runWallTime", std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count(), "s");
+
     EV << "TCP time:" << endl;
     EV << "     Mean: " << getInstance().tcpMsgStats->getMean() << endl;
     EV << "     Min:  " << getInstance().tcpMsgStats->getMin() << endl;
@@ -118,6 +851,23 @@ void ExperimentControl::finish() {
     EV << "     Mean: " << getInstance().directMsgStats->getMean() << endl;
     EV << "     Min:  " << getInstance().directMsgStats->getMin() << endl;
     EV << "     Max:  " << getInstance().directMsgStats->getMax() << endl;
+    if (usesLayer(0))
+        EV << "Flow rate updates: " << getInstance().flows.getNumRateUpdates() << endl;
+    if (getInstance().messages)
+        EV << "Pooled messages: " << getInstance().messages->getNumCreated() << " created, " << getInstance().messages->getNumReused() << " reused" << endl;
+    if (getInstance().directBatching)
+        EV << "Batched direct messages: " << getInstance().batches.getNumPosted() << " in " << getInstance().batches.getNumBatches() << " batches, "
+           << getInstance().batches.getNumPending() << " never collected" << endl;
+    if (getInstance().directLoss)
+        EV << "Direct retransmissions: " << getInstance().directRetransmissions << endl;
+    if (getInstance().connectionHandoff)
+        EV << "Held connections: " << getInstance().handoffs.getNumHeld() << ", " << getInstance().handoffs.getNumResumed() << " resumed, "
+           << getInstance().handoffs.getNumLost() << " lost" << endl;
+    if (getInstance().migrateInFlight)
+        EV << "Migrated replies: " << getInstance().migratedReplies << endl;
+    if (forks.getBranch() > 0)
+        EV << "Branch " << forks.getBranch() << " of the fork at " << forkAt << endl;
+    forks.waitForBranches();
 }
 
 }
@@ -18,9 +18,29 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <set>
 #include <algorithm>
+#include <chrono>
 #include <omnetpp.h>
 
+#include "inet/common/INETDefs.h"
+
+#include "common/BulkTransferModel.h"
+#include "common/DelayModel.h"
+#include "common/DirectBatch.h"
+#include "common/DirectLinkModel.h"
+#include "common/DirectPeerRegistry.h"
+#include "common/FidelityRegions.h"
+#include "common/FidelitySchedule.h"
+#include "common/FlowEngine.h"
+#include "common/ForkPoint.h"
+#include "common/InstrumentedScheduler.h"
+#include "common/MessagePool.h"
+#include "common/PartitionMap.h"
+#include "common/RoutingGraph.h"
+#include "TcpHandoff.h"
+
 using namespace omnetpp;
 using std::string;
 using std::vector;
@@ -36,29 +56,143 @@ enum msg_kind : short int {
     TIMER = 16,
     RESTART_TCP = 17,
     STOP_TCP = 18,
-    RECORD_TIME = 19,
+    ADAPT_TIMER = 19,
     START_MSG = 20,
-    END_MSG = 21
+    END_MSG = 21,
+    BULK_REPLY = 22,
+    MIGRATED_REPLY = 23,
+    FORK_MSG = 24,
+    PARTITION_TOPOLOGY = 25,
+    PARTITION_DRAINED = 26,
 };
 
-class ExperimentControl : public cSimpleModule {
+class ExperimentControl : public cSimpleModule, public InstrumentedScheduler::IClockListener {
 
     private:
-        short int state = 1;
-        bool switchActive = false;
+        short int state = 7; // layer of the most recently entered window
+        bool switchActive = false; // true while any window is active
+        ExperimentControl *controller = nullptr; // module instance driving the simulation
+        std::map<string, const FidelityWindow*> nodeWindow; // active window of each switched node
+        long fidelityGeneration = 0; // bumped whenever a window is entered, committed or left
+        DirectPeerRegistry peers;
+        MessagePool *messages = nullptr; // owned by the controller module
+        RoutingGraph graph;
+        DelayModel delays; // learned from packet-level round trips if calibrateDelays
+        bool calibrateDelays = false;
+        DirectLinkModel links; // loss and jitter of the direct links, if directLoss or directJitter; message sizes of layer 0
+        FlowEngine flows; // layer 0
+        DirectBatch batches; // layer-1 answers waiting for their parent's next TIMER, if directBatching
+        bool directBatching = false;
+        bool directLoss = false;
+        bool directJitter = false;
+        simtime_t retransmissionTimeout;
+        long directRetransmissions = 0;
+        std::map<const cDatarateChannel*, simtime_t> bypassBusyUntil; // layer 2: end of the last segment on each channel
+        BulkTransferModel bulkTransfers; // layer 3
+        int64_t bulkThreshold = 0;
+        TcpHandoff handoffs; // connections kept idle through layer-0/1 windows, if connectionHandoff
+        bool connectionHandoff = false;
+        bool migrateInFlight = false;
+        long migratedReplies = 0;
+
+        // true if node and peer are linked and in the same active window of the given layer
+        bool isLinkInWindow(const char *node, const char *peer, int layer) const;
+
+        // targets of a window that have drained their TCP requests
+        struct WindowBarrier {
+            int numNodes = 0;
+            int numNodesReady = 0;
+            int numPartitionsReady = 0; // other partitions whose targets have drained
+            bool reported = false; // the local targets have drained and the other partitions know
+            bool committed = false;
+        };
+        std::map<const FidelityWindow*, WindowBarrier> barriers;
 
     protected:
-        const int currentLayer = 7;
-        const int newLayer = 1;
-        const_simtime_t start_time = 100;
-        const_simtime_t end_time = 200;
+        int currentLayer = 7; // number of layers simulated outside abstraction windows
+        FidelitySchedule schedule;
+        FidelityRegions regions;
+        std::set<const FidelityWindow*> activeWindows;
+
+        // recorded for simulations/benchmark.py
+        cHistogram transitionLatency {"transitionLatency"}; // simulated time from the start of a window until its direct traffic starts
+        std::chrono::steady_clock::time_point runStart; // end of initialization
+
+        // clocks of the run against simulated time, sampled by the scheduler without events;
+        // named in initialize(), so that only the module and not getInstance() registers them
+        simtime_t clockSampleInterval;
+        InstrumentedScheduler::ClockSample lastClock;
+        cOutVector wallTimes;
+        cOutVector cpuTimes;
+        cOutVector eventCounts;
+        FidelityWindow adaptiveWindow; // window entered and left by the adaptive mode
+        simtime_t drainTimeout; // start direct traffic after this long even if some targets have not drained
+        std::map<const FidelityWindow*, cMessage*> drainDeadlines;
+        cMessage *flowTimer = nullptr; // next message completed by the flow engine
+        bool hasSwitch = true;
+
+        // parallel runs: this controller is the replica of one partition, see common/PartitionMap.h
+        PartitionMap partitions;
+        int numTopologies = 0; // other partitions that have reported their links
+
+        // what-if branches forked at forkAt, see common/ForkPoint.h
+        simtime_t forkAt;
+        ForkPoint forks;
+        FidelitySchedule branchSchedule; // windows of this branch from forkAt on, replacing those of schedule
+
+        // wall-clock budget mode
+        bool adaptive = false;
+        int adaptiveLayer = 1;
+        double wallClockBudget = 0; // wall-clock seconds allowed per simulated second
+        double headroomFactor = 1;
+        simtime_t minDwellTime;
+        simtime_t accuracyCheckInterval;
+        simtime_t accuracyCheckDuration;
+        simtime_t lastSwitchTime = 0;
+        simtime_t accuracyCheckUntil = 0;
+        bool transitionPending = false; // from scheduling a switch until its window is committed or left
+        cMessage *adaptTimer = nullptr; // compares lastClock with the budget every clockSampleInterval
 
-        vector<string> sources = {"DF1", "DF2", "M"};
-        vector<string> targets = {"SN1", "SN2", "SN3", "SN4", "DF1", "DF2"};
+        vector<string> sources; // hosts with children in the routing graph
+        vector<string> targets; // hosts with a parent in the routing graph
 
-        virtual void initialize() override;
+        virtual int numInitStages() const override { return NUM_INIT_STAGES; }
+        virtual void initialize(int stage) override;
         virtual void handleMessage(cMessage* msg) override;
 
+        virtual void clockSampled(const InstrumentedScheduler::ClockSample& sample) override;
+        void adaptFidelity(double elapsed);
+        void beginAbstraction(int layer);
+        void endAbstraction();
+
+        void scheduleTransition(const char *name, short int kind, simtime_t time, const FidelityWindow& window);
+        void scheduleFork();
+        void forkBranches();
+        void checkLayers(const FidelitySchedule& windows) const;
+
+        // models and checks needed by the layers of the schedule, once the application tree is known
+        void prepareLayers();
+        void startFlowTransfer(const char *from, const char *to, cMessage *msg);
+        void deliverFlows();
+        void scheduleFlowTimer();
+
+        void enterWindow(const FidelityWindow& window);
+        void leaveWindow(const FidelityWindow& window);
+        void windowDrained(const FidelityWindow& window);
+        void checkBarrier(const FidelityWindow& window);
+        void commitWindow(const FidelityWindow& window);
+
+        // sources and targets among the local hosts, again whenever links of other partitions become known
+        void collectEndpoints();
+        void checkPartitions() const;
+        void sendTopology();
+        void receiveFromPartition(cMessage *msg);
+        void forwardToPartition(const DirectPeer& peer, cMessage *msg, simtime_t delay);
+
+        // targets whose link to the parent lies inside the window's region, and the parents of those
+        vector<string> getWindowTargets(const FidelityWindow& window) const;
+        vector<string> getWindowSources(const FidelityWindow& window) const;
+
     public:
         static ExperimentControl instance;
 
@@ -75,17 +209,104 @@ class ExperimentControl : public cSimpleModule {
 
         int getState() const;
         bool getSwitchStatus() const;
+
+        // changes whenever the fidelity of any host may have changed, see common/DirectRoles.h
+        long getFidelityGeneration() const { return getInstance().fidelityGeneration; }
+
+        // fidelity of a single host, by module name
+        int getState(const char *node) const;
+        bool getSwitchStatus(const char *node) const;
+
+        // application tree derived from the NED topology
+        const string& getParent(const char *node) const;
+        const vector<string>& getChildren(const char *node) const;
+
+        // plain control and direct-mode messages, recycled through the controller's pool
+        cMessage *acquireMessage(const char *name, short kind);
+        void releaseMessage(cMessage *msg);
+
+        // cached app[0]/appIn (and transport) endpoints of a host, for sendDirect()
+        const DirectPeer& getPeer(const string& host);
+
+        // instead of sendDirect() to a peer in another partition: the controller of that partition
+        // hands msg to the peer's app after delay, which must not be shorter than the lookahead
+        void sendToPartition(const DirectPeer& peer, cMessage *msg, simtime_t delay);
+
+        // layer 0: msg reaches the app of `to` once the flow from `from` has carried one message of
+        // their link, at a max-min fair share of the channels plus their propagation delay
+        void sendFlow(const char *from, const char *to, cMessage *msg);
+
+        // layer 1 with directBatching: children post their answers, and the parent collects the ones
+        // that arrived by now once per TIMER epoch instead of receiving each as an event
+        bool isBatched(const char *node) const;
+        void postDirect(const char *node, int source, simtime_t sent, simtime_t arrival);
+        vector<DirectRecord> collectDirect(const char *node);
+
+        // one-way delay of a direct message between node and its parent, or a random
+        // directly linked child; fallback unless delayModel is "calibrated"
+        simtime_t getParentDelay(const char *node, simtime_t fallback);
+        simtime_t getChildDelay(const char *node, simtime_t fallback);
+
+        // extra delay of a direct message from node to its parent (up) or back: channel jitter and
+        // the timeouts of retransmitting lost segments, if directJitter / directLoss are set
+        simtime_t getTransferPenalty(const char *node, bool up);
+
+        cModule *findHost(const L3Address& address);
+
+        // layer 2: true if segments between the two hosts skip ipv4/ppp, i.e. they are linked and in
+        // the same active layer-2 window; false if the segment is lost, else delay is its arrival delay
+        bool isBypassed(const char *node, const char *peer) const;
+        bool getBypassDelay(const char *node, const char *peer, int64_t bits, simtime_t& delay);
+
+        // layer 3: true if a reply of `bytes` from server to client is delivered as one event after
+        // the modeled bulk transfer time, instead of as segments
+        bool isBulkModeled(const char *server, const char *client, int64_t bytes) const;
+        simtime_t getBulkCompletionTime(const char *server, const char *client, int64_t bytes) const;
+
+        // true if the link between node and its parent is abstracted, i.e. both ends are in the same active layer-0 or layer-1 window
+        bool isDirectLink(const char *node) const;
+
         void setState();
+        void readSchedule();
+        bool usesLayer(int layer) const;
+
+        // called once by each target after STOP_TCP, when it has no request in flight
+        void reportDrained(const char *node);
 
-        void sendToSources(cMessage *msg);
-        void sendToTargets(cMessage *msg);
+        // connectionHandoff: a drained target keeps its connection to the parent open and idle
+        // instead of destroying it, and carries on with it after RESTART_TCP without a new handshake
+        bool keepsConnections() const { return getInstance().connectionHandoff; }
+        bool holdConnection(const char *node, int socketId);
+        bool resumeConnection(const char *node, int socketId);
+
+        // migrateInFlight: at STOP_TCP a target hands the replies it still waits for to the direct mode
+        // instead of draining them, so the window starts on time; each comes back as a MIGRATED_REPLY
+        // at the arrival returned here, one direct round trip after its request was sent
+        bool migratesInFlight() const { return getInstance().migrateInFlight; }
+        bool getMigratedArrival(const char *node, simtime_t sent, simtime_t fallback, simtime_t& arrival);
+
+        void sendToSources(cMessage *msg, const FidelityWindow& window);
+        void sendToTargets(cMessage *msg, const FidelityWindow& window);
 
         void addTcpStats(simtime_t previousTime, simtime_t currentTime);
+        // round trip of a request sent by node to its parent, for the calibrated delay model
+        void addRoundTrip(const char *node, simtime_t sent, simtime_t arrival);
         void addDirectStats(simtime_t previousTime, simtime_t currentTime);
 
         virtual void finish() override;
 };
 
+// transport of the direct-mode roles in common/DirectRoles.h
+struct TcpDirectTransport {
+    typedef ExperimentControl Control;
+    typedef msg_kind Kind;
+    static Control& control() { return ExperimentControl::getInstance(); }
+    static bool transfer(const char *node, bool up, simtime_t& delay) {
+        delay = control().getTransferPenalty(node, up);
+        return true;
+    }
+};
+
 }
 
 #endif /* EXPERIMENTCONTROL_H_ */
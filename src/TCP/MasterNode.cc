@@ -45,14 +45,9 @@ void MasterNode::initialize(int stage)
         WATCH(msgsSent);
         WATCH(bytesRcvd);
         WATCH(bytesSent);
+        data.configure(par("dataCapacity"), par("dataRetention"));
 
         directArrival = registerSignal("directMsgArrived");
-        realTime = registerSignal("recordWallTime");
-
-        startClock = Clock::now();
-
-        cMessage *wallTime = new cMessage("record_wall_time", msg_kind::RECORD_TIME);
-        scheduleAt(simTime(), wallTime);
     }
     else if (stage == INITSTAGE_APPLICATION_LAYER) {
         const char *localAddress = par("localAddress");
@@ -100,53 +95,18 @@ void MasterNode::sendBack(cMessage *msg)
 
 void MasterNode::handleMessage(cMessage *msg)
 {
-    if (msg->getKind() == msg_kind::RECORD_TIME) {
-        std::chrono::duration<double> elapsed_seconds = Clock::now() - startClock;
-        emit(realTime, elapsed_seconds.count());
-        scheduleAt(simTime() + 1, msg);
+    // fusion nodes outside the region still talk TCP to the master
+    if (handleParentMessage(msg))
         return;
-    }
-
-    if (ExperimentControl::getInstance().getSwitchStatus()) {
-        if (msg->getKind() == msg_kind::TIMER || msg->getKind() == msg_kind::INIT_TIMER) {
-            // Set time
-            lastDirectMsgTime = simTime();
-
-            // Schedule next TIMER call
-            cMessage* tmMsg = new cMessage(nullptr, msg_kind::TIMER);
-            scheduleAt(simTime() + frequency, tmMsg);
-
-            // Schedule message to be finally sent after propagation delay
-            EV_INFO << "delayedMsgSend " << simTime();
-            delayedMsgSend(msg, ExperimentControl::getInstance().getState());
-        } else if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-            EV_INFO << "finalMsgSend " << simTime();
-            for (std::string s : targets) {
-                std::string targetPath("TCPnetworksim." + s + ".app[0]");
-                finalMsgSend(msg, targetPath.c_str(), ExperimentControl::getInstance().getState());
-            }
-            delete msg;
-        } else if (msg->getKind() == msg_kind::APP_MSG_RETURNED) {
-            saveData(msg);
-            emit(directArrival, SIMTIME_DBL(simTime()) - SIMTIME_DBL(lastDirectMsgTime));
-            ExperimentControl::getInstance().addDirectStats(lastDirectMsgTime, simTime());
-        } else {
-            delete msg;
-        }
-        return;
-    }
 
     if (msg->isSelfMessage()) {
-        if (msg->getKind() == msg_kind::TIMER) {
-            delete msg;
-        } else {
-            sendBack(msg);
-        }
+        sendBack(msg);
     }
     else if (msg->getKind() == TCP_I_PEER_CLOSED) {
         // we'll close too, but only after there's surely no message
         // pending to be sent back in this connection
         int connId = check_and_cast<Indication *>(msg)->getTag<SocketInd>()->getSocketId();
+        clientHosts.erase(connId);
         delete msg;
         auto request = new Message("close", TCP_C_CLOSE);
         request->addTagIfAbsent<SocketReq>()->setSocketId(connId);
@@ -179,7 +139,11 @@ void MasterNode::handleMessage(cMessage *msg)
                 payload->setExpectedReplyLength(B(0));
                 payload->setReplyDelay(0);
                 outPacket->insertAtBack(payload);
-                sendOrSchedule(outPacket, delay + msgDelay);
+                auto client = clientHosts.find(connId);
+                if (client != clientHosts.end() && ExperimentControl::getInstance().isBulkModeled(getParentModule()->getFullName(), client->second.c_str(), B(requestedBytes).get()))
+                    sendBulkReply(outPacket, client->second, delay + msgDelay);
+                else
+                    sendOrSchedule(outPacket, delay + msgDelay);
             }
             if (appmsg->getServerClose()) {
                 doClose = true;
@@ -198,6 +162,14 @@ void MasterNode::handleMessage(cMessage *msg)
     }
     else if (msg->getKind() == TCP_I_AVAILABLE)
         socket.processMessage(msg);
+    else if (msg->getKind() == TCP_I_ESTABLISHED) {
+        // remember which host each accepted connection comes from, for layer-3 replies
+        int connId = check_and_cast<Indication *>(msg)->getTag<SocketInd>()->getSocketId();
+        cModule *client = ExperimentControl::getInstance().findHost(check_and_cast<TcpConnectInfo *>(msg->getControlInfo())->getRemoteAddr());
+        if (client)
+            clientHosts[connId] = client->getFullName();
+        delete msg;
+    }
     else {
         // some indication -- ignore
         EV_WARN << "drop msg: " << msg->getName() << ", kind:" << msg->getKind() << "(" << cEnum::get("inet::TcpStatusInd")->getStringFor(msg->getKind()) << ")\n";
@@ -216,45 +188,9 @@ void MasterNode::finish()
 {
     EV_INFO << getFullPath() << ": sent " << bytesSent << " bytes in " << msgsSent << " packets\n";
     EV_INFO << getFullPath() << ": received " << bytesRcvd << " bytes in " << msgsRcvd << " packets\n";
-}
-
-void MasterNode::saveData(cMessage* msg) {
-    data.push_back("data");
-    delete msg;
-}
-
-void MasterNode::delayedMsgSend(cMessage* msg, int layer) {
-    switch (layer) {
-        case 1:
-            if ((msg->isSelfMessage() && msg->getKind() == msg_kind::TIMER) || msg->getKind() == msg_kind::INIT_TIMER) {
-                delete msg;
-                msg = new cMessage(nullptr, msg_kind::APP_SELF_MSG);
-                scheduleAt(simTime() + propagationDelay, msg);
-            } else {
-                error("Must be a self message with kind TIMER or message with kind INIT_TIMER");
-            }
-            break;
-        default:
-            error("Invalid route");
-            break;
-    }
-}
-
-void MasterNode::finalMsgSend(cMessage* msg, const char* mod, int layer) {
-    switch (layer) {
-        case 1:
-            if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-                cMessage *tmp = new cMessage(nullptr, msg_kind::APP_MSG_SENT);
-                cModule *targetModule = getModuleByPath(mod);
-                sendDirect(tmp, targetModule, "appIn");
-            } else {
-                error("Must be a self message with kind APP_SELF_MSG");
-            }
-            break;
-        default:
-            error("Invalid route");
-            break;
-    }
+    long numHeld;
+    double age = data.fuse(SIMTIME_ZERO, &numHeld);
+    EV_INFO << getFullPath() << ": holds " << numHeld << " of " << data.getNumReceived() << " readings received, mean age " << age << "s\n";
 }
 
 }
@@ -17,6 +17,7 @@
 #define MASTERNODE_H_
 
 #include "ExperimentControl.h"
+#include "common/DirectRoles.h"
 
 #include "inet/common/lifecycle/LifecycleUnsupported.h"
 #include "inet/common/packet/ChunkQueue.h"
@@ -24,23 +25,18 @@
 
 #include <vector>
 #include <string>
-#include <chrono>
-
-typedef std::chrono::system_clock Clock;
 
 namespace inet {
 
-class MasterNode : public cSimpleModule, public LifecycleUnsupported {
+class MasterNode : public cSimpleModule, public LifecycleUnsupported, public DirectParentRole<MasterNode, TcpDirectTransport> {
+
+    friend class DirectParentRole<MasterNode, TcpDirectTransport>;
 
     private:
         simsignal_t directArrival;
-        simsignal_t realTime;
-
-        std::chrono::time_point<Clock> startClock;
 
     protected:
-        vector<string> data;
-        const vector<string> targets = {"DF1", "DF2"};
+        SensorStore data; // readings received in direct mode
 
         const_simtime_t propagationDelay = 0.1;
         const_simtime_t frequency = 2;
@@ -55,8 +51,7 @@ class MasterNode : public cSimpleModule, public LifecycleUnsupported {
         long bytesSent;
 
         std::map<int, ChunkQueue> socketQueue;
-
-        simtime_t lastDirectMsgTime = 0;
+        std::map<int, string> clientHosts; // host behind each accepted connection
 
     public:
         virtual void sendBack(cMessage *msg);
@@ -67,11 +62,6 @@ class MasterNode : public cSimpleModule, public LifecycleUnsupported {
         virtual void handleMessage(cMessage *msg) override;
         virtual void finish() override;
         virtual void refreshDisplay() const override;
-
-        void saveData(cMessage* msg);
-
-        virtual void delayedMsgSend(cMessage* msg, int layer);
-        virtual void finalMsgSend(cMessage* msg, const char* mod, int layer);
 };
 
 }
@@ -99,6 +99,7 @@ void SensorNode::sendRequest()
             << "remaining " << numRequestsToSend - 1 << " request\n";
 
     sendPacket(packet);
+    requestSent();
 }
 
 void SensorNode::handleTimer(cMessage *msg)
@@ -159,6 +160,7 @@ void SensorNode::rescheduleOrDeleteTimer(simtime_t d, short int msgKind)
 void SensorNode::socketDataArrived(TcpSocket *socket, Packet *msg, bool urgent)
 {
 
+    replyArrived(msg->getKind() != msg_kind::BULK_REPLY); // a bulk reply is modeled
     TcpAppBase::socketDataArrived(socket, msg, urgent);
 
     if (!tcpMsgTimes.empty()) {
@@ -179,10 +181,16 @@ void SensorNode::socketDataArrived(TcpSocket *socket, Packet *msg, bool urgent)
 
         tcpMsgTimes.push(simTime());
     }
+    else if (numRequestsToSend > 0 && drainPending && ExperimentControl::getInstance().keepsConnections()) {
+        EV_INFO << "reply arrived, keeping the connection idle until RESTART_TCP\n";
+    }
     else if (socket->getState() != TcpSocket::LOCALLY_CLOSED) {
         EV_INFO << "reply to last request arrived, closing session\n";
         close();
     }
+
+    if (drainPending && tcpMsgTimes.empty())
+        finishDrain();
 }
 
 void SensorNode::close()
@@ -214,41 +222,47 @@ void SensorNode::socketFailure(TcpSocket *socket, int code)
 }
 
 void SensorNode::handleMessage(cMessage *msg) {
-    if (msg->getKind() == msg_kind::APP_MSG_SENT) {
-        delete msg;
-        msg = new cMessage(nullptr, msg_kind::APP_SELF_MSG);
-        scheduleAt(simTime() + propagationDelay, msg);
-    } else if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-        msg->setKind(msg_kind::APP_MSG_RETURNED);
-        cModule *targetModule = getModuleByPath(getDirectDestination(getParentModule()->getName()));
-        sendDirect(msg, targetModule, "appIn");
+    if (handleChildMessage(msg)) {
+        return;
     } else if (msg->getKind() == msg_kind::STOP_TCP) {
         switchActive = true;
-        // TODO: Check for packets still in progress
-        if (!tcpMsgTimes.empty()) {
-            scheduleAt(simTime() + 0.01, msg);
-        } else {
-            socket.destroy();
-            cancelEvent(timeoutMsg);
-            delete msg;
+        // the last reply completes the drain in socketDataArrived()
+        drainPending = true;
+        if (ExperimentControl::getInstance().migratesInFlight()) {
+            // a request still in think time was never sent, finishDrain() cancels its timer
+            tcpMsgTimes = queue<simtime_t>();
+            finishDrain(!migrateInFlight()); // a connection that still carries the migrated reply is not kept
+        } else if (tcpMsgTimes.empty()) {
+            finishDrain();
         }
+        ExperimentControl::getInstance().releaseMessage(msg);
     } else if (msg->getKind() == msg_kind::RESTART_TCP) {
         switchActive = false;
-        timeoutMsg->setKind(MSGKIND_CONNECT);
-        scheduleAt(simTime(), timeoutMsg);
-        delete msg;
+        drainPending = false;
+        if (ExperimentControl::getInstance().resumeConnection(getParentModule()->getFullName(), socket.getSocketId())) {
+            // the held connection goes on with the next request of its session
+            tcpMsgTimes.push(simTime());
+            rescheduleOrDeleteTimer(simTime(), MSGKIND_SEND);
+        } else {
+            timeoutMsg->setKind(MSGKIND_CONNECT);
+            scheduleAt(simTime(), timeoutMsg);
+        }
+        ExperimentControl::getInstance().releaseMessage(msg);
+    } else if (msg->getKind() == msg_kind::BULK_REPLY) {
+        // a whole reply from the parent, modeled as one layer-3 transfer
+        socketDataArrived(&socket, check_and_cast<Packet *>(msg), false);
     } else {
         OperationalBase::handleMessage(msg);
     }
 }
 
-const char* SensorNode::getDirectDestination(const char* currentMod) const {
-    if (strcmp(currentMod, "SN1") == 0 || strcmp(currentMod, "SN2") == 0) {
-        return "TCPnetworksim.DF1.app[0]";
-    } else if (strcmp(currentMod, "SN3") == 0 || strcmp(currentMod, "SN4") == 0) {
-        return "TCPnetworksim.DF2.app[0]";
-    }
-    return "";
+void SensorNode::finishDrain(bool keepConnection) {
+    drainPending = false;
+    if (!keepConnection || !ExperimentControl::getInstance().holdConnection(getParentModule()->getFullName(), socket.getSocketId()))
+        socket.destroy();
+    cancelEvent(timeoutMsg);
+    clearInFlight();
+    ExperimentControl::getInstance().reportDrained(getParentModule()->getFullName());
 }
 
 }
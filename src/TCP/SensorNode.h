@@ -17,6 +17,7 @@
 #define SENSORNODE_H_
 
 #include "ExperimentControl.h"
+#include "common/DirectRoles.h"
 #include "inet/common/INETDefs.h"
 
 #include "inet/applications/tcpapp/TcpAppBase.h"
@@ -29,7 +30,9 @@ using std::queue;
 
 namespace inet {
 
-class SensorNode : public TcpAppBase {
+class SensorNode : public TcpAppBase, public DirectChildRole<SensorNode, TcpDirectTransport> {
+
+    friend class DirectChildRole<SensorNode, TcpDirectTransport>;
 
     private:
         simsignal_t tcpArrival;
@@ -46,6 +49,7 @@ class SensorNode : public TcpAppBase {
         simtime_t stopTime;
 
         queue<simtime_t> tcpMsgTimes;
+        bool drainPending = false; // STOP_TCP received, waiting for the last reply
 
         virtual void sendRequest();
         virtual void rescheduleOrDeleteTimer(simtime_t d, short int msgKind);
@@ -66,8 +70,8 @@ class SensorNode : public TcpAppBase {
         virtual void close() override;
 
         virtual void handleMessage(cMessage *msg) override;
+        void finishDrain(bool keepConnection = true);
 
-        const char* getDirectDestination(const char* currentMod) const;
 
     public:
         SensorNode();
@@ -0,0 +1,99 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#include "TcpHandoff.h"
+
+#include "inet/transportlayer/tcp/flavours/TcpTahoeRenoFamily.h"
+
+namespace inet {
+
+using namespace tcp;
+
+void TcpHandoff::clear() {
+    held.clear();
+    numHeld = 0;
+    numResumed = 0;
+    numLost = 0;
+}
+
+TcpConnection *TcpHandoff::findConnection(cModule *host, int socketId) {
+    cModule *tcp = host->getSubmodule("tcp");
+    if (!tcp)
+        return nullptr;
+    for (cModule::SubmoduleIterator it(tcp); !it.end(); ++it) {
+        TcpConnection *conn = dynamic_cast<TcpConnection *>(*it);
+        if (conn && conn->getSocketId() == socketId)
+            return conn;
+    }
+    return nullptr;
+}
+
+bool TcpHandoff::hold(cModule *host, int socketId) {
+    TcpConnection *conn = findConnection(host, socketId);
+    if (!conn || conn->getFsmState() != TCP_S_ESTABLISHED)
+        return false;
+
+    TcpStateVariables *state = conn->getState();
+    Snapshot& snapshot = held[host->getFullName()];
+    snapshot = Snapshot();
+    snapshot.sndUna = state->snd_una;
+    snapshot.sndNxt = state->snd_nxt;
+    snapshot.rcvNxt = state->rcv_nxt;
+    snapshot.takenAt = simTime();
+    if (TcpBaseAlgStateVariables *alg = dynamic_cast<TcpBaseAlgStateVariables *>(state)) {
+        snapshot.cwnd = alg->snd_cwnd;
+        snapshot.srtt = alg->srtt;
+        snapshot.rttvar = alg->rttvar;
+        snapshot.rto = alg->rexmit_timeout;
+    }
+    if (TcpTahoeRenoFamilyStateVariables *reno = dynamic_cast<TcpTahoeRenoFamilyStateVariables *>(state))
+        snapshot.ssthresh = reno->ssthresh;
+
+    EV_INFO << "holding connection of " << host->getFullName() << ": snd_una " << snapshot.sndUna << ", snd_nxt " << snapshot.sndNxt
+            << ", cwnd " << snapshot.cwnd << ", ssthresh " << snapshot.ssthresh << ", srtt " << snapshot.srtt << endl;
+    numHeld++;
+    return true;
+}
+
+bool TcpHandoff::resume(cModule *host, int socketId) {
+    auto it = held.find(host->getFullName());
+    if (it == held.end())
+        return false;
+    Snapshot snapshot = it->second;
+    held.erase(it);
+
+    TcpConnection *conn = findConnection(host, socketId);
+    if (!conn || conn->getFsmState() != TCP_S_ESTABLISHED || conn->getState()->snd_una != snapshot.sndUna) {
+        numLost++;
+        return false;
+    }
+
+    TcpStateVariables *state = conn->getState();
+    if (TcpBaseAlgStateVariables *alg = dynamic_cast<TcpBaseAlgStateVariables *>(state)) {
+        alg->snd_cwnd = snapshot.cwnd;
+        alg->srtt = snapshot.srtt;
+        alg->rttvar = snapshot.rttvar;
+        alg->rexmit_timeout = snapshot.rto;
+    }
+    if (TcpTahoeRenoFamilyStateVariables *reno = dynamic_cast<TcpTahoeRenoFamilyStateVariables *>(state))
+        reno->ssthresh = snapshot.ssthresh;
+
+    EV_INFO << "resuming connection of " << host->getFullName() << " after " << simTime() - snapshot.takenAt << endl;
+    numResumed++;
+    return true;
+}
+
+}
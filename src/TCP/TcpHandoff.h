@@ -0,0 +1,82 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef TCPHANDOFF_H_
+#define TCPHANDOFF_H_
+
+#include <map>
+#include <string>
+
+#include "inet/common/INETDefs.h"
+#include "inet/transportlayer/tcp/TcpConnection.h"
+
+using std::string;
+
+namespace inet {
+
+/**
+ * Connection state of an application's TCP connection, kept while its link
+ * is abstracted so that the connection can carry on where it stopped once
+ * the link returns to packet level.
+ *
+ * The connection itself stays open and idle in its tcp module for the
+ * whole window. Direct and flow messages never enter its byte stream, so
+ * the sequence numbers on both ends stay consistent without being touched.
+ * The snapshot holds the congestion window, slow-start threshold and RTT
+ * estimator, which are written back on resume so the connection restarts
+ * with the window and RTO it had built up rather than from an idle restart.
+ */
+class TcpHandoff {
+
+    public:
+        struct Snapshot {
+            uint32_t sndUna = 0;
+            uint32_t sndNxt = 0;
+            uint32_t rcvNxt = 0;
+            uint32_t cwnd = 0;
+            uint32_t ssthresh = 0;
+            simtime_t srtt;
+            simtime_t rttvar;
+            simtime_t rto;
+            simtime_t takenAt;
+        };
+
+    private:
+        std::map<string, Snapshot> held; // by host name
+        long numHeld = 0;
+        long numResumed = 0;
+        long numLost = 0; // held, but closed or reset before the window ended
+
+        // connection of the app socket in host's tcp module, nullptr if it is gone
+        static tcp::TcpConnection *findConnection(cModule *host, int socketId);
+
+    public:
+        void clear();
+
+        // snapshots an established connection of host; false if there is none to keep
+        bool hold(cModule *host, int socketId);
+
+        // restores the snapshot of host; false if nothing was held or the connection did not survive
+        bool resume(cModule *host, int socketId);
+
+        long getNumHeld() const { return numHeld; }
+        long getNumResumed() const { return numResumed; }
+        long getNumLost() const { return numLost; }
+};
+
+}
+
+#endif /* TCPHANDOFF_H_ */
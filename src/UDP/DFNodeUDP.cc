@@ -51,6 +51,7 @@ void DFNodeUDP::initialize(int stage)
         WATCH(numEchoed);
         WATCH(numSent);
         WATCH(numReceived);
+        data.configure(par("dataCapacity"), par("dataRetention"));
 
         localPort = par("localPort");
         destPort = par("destPort");
@@ -64,73 +65,57 @@ void DFNodeUDP::initialize(int stage)
 
         directArrival = registerSignal("directMsgArrived");
         udpArrival = registerSignal("udpPkArrived");
-
-        ExperimentControlUDP::getInstance().incrementNumNodes();
     }
 }
 
 void DFNodeUDP::handleMessageWhenUp(cMessage *msg)
 {
-    if (ExperimentControlUDP::getInstance().getSwitchStatus() && ExperimentControlUDP::getInstance().getState() == 1) {
-        if (msg->getKind() == msg_kind::TIMER || msg->getKind() == msg_kind::INIT_TIMER) {
-            // Set time
-            lastDirectMsgTime = simTime();
-
-            // Schedule next TIMER call
-            cMessage* tmMsg = new cMessage(nullptr, msg_kind::TIMER);
-            scheduleAt(simTime() + frequency, tmMsg);
-
-            // Schedule message to be finally sent after propagation delay
-            EV_INFO << "delayedMsgSend " << getParentModule()->getName() << " " << simTime();
-            delayedMsgSend(msg, ExperimentControlUDP::getInstance().getState());
-        } else if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-            EV_INFO << "finalMsgSend " << getParentModule()->getName() << " " << simTime();
-            finalMsgSendRouter(msg, getParentModule()->getName());
-        } else if (msg->getKind() == msg_kind::APP_MSG_RETURNED) {
-            saveData(msg);
-            emit(directArrival, SIMTIME_DBL(simTime()) - SIMTIME_DBL(lastDirectMsgTime));
-            ExperimentControlUDP::getInstance().addDirectStats(lastDirectMsgTime, simTime());
-        } else {
-            handleDirectMessage(msg);
-        }
+    if (handleParentMessage(msg) || handleChildMessage(msg))
+        return;
+
+    const char *name = getParentModule()->getFullName();
+    ExperimentControlUDP& control = ExperimentControlUDP::getInstance();
+    if (control.getSwitchStatus(name) && isApplicationLevel(control.getState(name))) {
+        handleDirectMessage(msg);
     } else if (msg->getKind() == msg_kind::RESTART_UDP) {
-        if (ExperimentControlUDP::getInstance().getNewLayer() == 1) {
+        if (isApplicationLevel(control.getNewLayer(name))) {
             ready = false;
-            socket.setOutputGate(gate("socketOut"));
-            int localPort = par("localPort");
-            const char *localAddress = par("localAddress");
-            socket.bind(*localAddress ? L3AddressResolver().resolve(localAddress) : L3Address(), localPort);
-            MulticastGroupList mgl = getModuleFromPar<IInterfaceTable>(par("interfaceTableModule"), this)->collectMulticastGroups();
-            socket.joinLocalMulticastGroups(mgl);
-            socket.setCallback(this);
-
-            selfMsg = new cMessage("restart", START);
+            drainPending = false;
+            if (socketDestroyed) {
+                socket.setOutputGate(gate("socketOut"));
+                int localPort = par("localPort");
+                const char *localAddress = par("localAddress");
+                socket.bind(*localAddress ? L3AddressResolver().resolve(localAddress) : L3Address(), localPort);
+                MulticastGroupList mgl = getModuleFromPar<IInterfaceTable>(par("interfaceTableModule"), this)->collectMulticastGroups();
+                socket.joinLocalMulticastGroups(mgl);
+                socket.setCallback(this);
+                socketDestroyed = false;
+            }
+
+            cancelEvent(selfMsg);
+            selfMsg->setKind(START);
             scheduleAt(simTime(), selfMsg);
-            delete msg;
-        } else if (ExperimentControlUDP::getInstance().getNewLayer() == 2) {
+            control.releaseMessage(msg);
+        } else if (control.getNewLayer(name) == 2) {
             //TODO
         }
     } else if (msg->isSelfMessage()) {
-        if (msg->getKind() == msg_kind::TIMER) {
-            delete msg;
-        } else {
-            ASSERT(msg == selfMsg);
-            switch (selfMsg->getKind()) {
-                case START:
-                    processStart();
-                    break;
-
-                case SEND:
-                    processSend();
-                    break;
-
-                case STOP:
-                    processStop();
-                    break;
-
-                default:
-                    throw cRuntimeError("Invalid kind %d in self message", (int)selfMsg->getKind());
-            }
+        ASSERT(msg == selfMsg);
+        switch (selfMsg->getKind()) {
+            case START:
+                processStart();
+                break;
+
+            case SEND:
+                processSend();
+                break;
+
+            case STOP:
+                processStop();
+                break;
+
+            default:
+                throw cRuntimeError("Invalid kind %d in self message", (int)selfMsg->getKind());
         }
     } else if (msg->getKind() == msg_kind_transport::DIRECT_TO_APP) {
         delete msg;
@@ -140,41 +125,40 @@ void DFNodeUDP::handleMessageWhenUp(cMessage *msg)
 }
 
 void DFNodeUDP::handleDirectMessage(cMessage *msg) {
-    if (ExperimentControlUDP::getInstance().getState() == 1) {
-        if (msg->getKind() == msg_kind::APP_MSG_SENT) {
-            delete msg;
-            msg = new cMessage(nullptr, msg_kind::APP_SELF_MSG_CLIENT);
-            scheduleAt(simTime() + propagationDelay, msg);
-        } else if (msg->getKind() == msg_kind::APP_SELF_MSG_CLIENT) {
-            msg->setKind(msg_kind::APP_MSG_RETURNED);
-            cModule* targetModule = getModuleByPath("UDPnetworksim.M.app[0]");
-            sendDirect(msg, targetModule, "appIn");
-        } else if (msg->getKind() == msg_kind::STOP_UDP) {
-            if (udpMsgTimes.empty() && !ready) {
-                ExperimentControlUDP::getInstance().incrementNumReady();
-                ready = true;
+    const char *name = getParentModule()->getFullName();
+    ExperimentControlUDP& control = ExperimentControlUDP::getInstance();
+    if (isApplicationLevel(control.getState(name))) {
+        if (msg->getKind() == msg_kind::STOP_UDP) {
+            // the last reply completes the drain in processPacket()
+            drainPending = true;
+            if (control.migratesInFlight()) {
+                migrateInFlight();
+                udpMsgTimes = queue<simtime_t>();
             }
-
-            if (ExperimentControlUDP::getInstance().getNumNodes() == ExperimentControlUDP::getInstance().getNumReady()) {
+            checkDrained();
+            control.releaseMessage(msg);
+        } else if (msg->getKind() == msg_kind::COMMIT_UDP) {
+            // sensors outside the region still send to this socket
+            if (!control.hasPacketLevelChildren(name)) {
                 socket.destroy();
-                if (selfMsg->isSelfMessage()) {
-                    cancelEvent(selfMsg);
-                }
-
-                delete msg;
-            } else {
-                scheduleAt(simTime() + 0.01, msg);
+                socketDestroyed = true;
             }
-
+            if (selfMsg->isSelfMessage()) {
+                cancelEvent(selfMsg);
+            }
+            // replies still outstanding after the drain deadline are considered lost
+            udpMsgTimes = queue<simtime_t>();
+            clearInFlight();
+            control.releaseMessage(msg);
         } else if (msg != selfMsg) {
-            if (ExperimentControlUDP::getInstance().getNumNodes() == ExperimentControlUDP::getInstance().getNumReady()) {
+            if (socketDestroyed) {
                 delete msg;
             } else {
                 socket.processMessage(msg);
             }
         } else {
-            if (ExperimentControlUDP::getInstance().getSwitchStatus() && ExperimentControlUDP::getInstance().getNewLayer() == 1) {
-                delete msg;
+            if (control.isDirectLink(name)) {
+                // selfMsg stays unscheduled until RESTART_UDP
                 return;
             }
 
@@ -199,68 +183,10 @@ void DFNodeUDP::handleDirectMessage(cMessage *msg) {
     }
 }
 
-void DFNodeUDP::saveData(cMessage* msg) {
-    data.push_back("data");
-    delete msg;
-}
-
-void DFNodeUDP::delayedMsgSend(cMessage* msg, int layer) {
-    switch (layer) {
-        case 1:
-            if ((msg->isSelfMessage() && msg->getKind() == msg_kind::TIMER) || msg->getKind() == msg_kind::INIT_TIMER) {
-                delete msg;
-                msg = new cMessage(nullptr, msg_kind::APP_SELF_MSG);
-                scheduleAt(simTime() + propagationDelay, msg);
-            } else {
-                error("Must be a self message with kind TIMER or message with kind INIT_TIMER");
-            }
-            break;
-        case 2:
-            break;
-        default:
-            error("Invalid route");
-            break;
-    }
-}
-
-void DFNodeUDP::finalMsgSend(cMessage* msg, const char* mod, int layer) {
-    switch (layer) {
-        case 1:
-            if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-                cMessage *tmp = new cMessage(nullptr, msg_kind::APP_MSG_SENT);
-                cModule *targetModule = getModuleByPath(mod);
-                sendDirect(tmp, targetModule, "appIn");
-            } else {
-                error("Must be a self message with kind APP_SELF_MSG");
-            }
-            break;
-        case 2:
-            break;
-        default:
-            error("Invalid route");
-            break;
-    }
-}
-
-void DFNodeUDP::finalMsgSendRouter(cMessage* msg, const char* currentMod) {
-    if (ExperimentControlUDP::getInstance().getState() == 1) {
-        if (!msg->isSelfMessage()) {
-            error("Must be self message");
-        }
-        if (strcmp(currentMod, "DF1") == 0) {
-            for (std::string s : DF1targets) {
-                std::string targetPath("UDPnetworksim." + s + ".app[0]");
-                finalMsgSend(msg, targetPath.c_str(), ExperimentControlUDP::getInstance().getState());
-            }
-        } else if (strcmp(currentMod, "DF2") == 0) {
-            for (std::string s : DF2targets) {
-                std::string targetPath("UDPnetworksim." + s + ".app[0]");
-                finalMsgSend(msg, targetPath.c_str(), ExperimentControlUDP::getInstance().getState());
-            }
-        } else {
-            error("Current module not valid");
-        }
-        delete msg;
+void DFNodeUDP::checkDrained() {
+    if (drainPending && !ready && udpMsgTimes.empty()) {
+        ready = true;
+        ExperimentControlUDP::getInstance().reportDrained(getParentModule()->getFullName());
     }
 }
 
@@ -268,8 +194,9 @@ void DFNodeUDP::socketDataArrived(UdpSocket *socket, Packet *pk)
 {
     // determine its source address/port
     L3Address remoteAddress = pk->getTag<L3AddressInd>()->getSrcAddress();
-    string check = remoteAddress.str();
-    if (strcmp(remoteAddress.str().c_str(), "10.0.0.10") == 0 || strcmp(remoteAddress.str().c_str(), "10.0.0.22") == 0) { // ideally use map<module, ip> in EC
+    ExperimentControlUDP& control = ExperimentControlUDP::getInstance();
+    cModule *sender = control.findHost(remoteAddress);
+    if (sender && control.getParent(getParentModule()->getFullName()) == sender->getFullName()) { // reply from the parent
         processPacket(pk);
     } else {
         int srcPort = pk->getTag<L4PortInd>()->getSrcPort();
@@ -312,6 +239,9 @@ void DFNodeUDP::finish()
 {
     recordScalar("packets sent", numSent);
     recordScalar("packets received", numReceived);
+    long numHeld;
+    double age = data.fuse(SIMTIME_ZERO, &numHeld);
+    EV_INFO << getFullPath() << ": holds " << numHeld << " of " << data.getNumReceived() << " readings received, mean age " << age << "s\n";
     ApplicationBase::finish();
 }
 
@@ -360,11 +290,12 @@ L3Address DFNodeUDP::chooseDestAddr()
 
 void DFNodeUDP::sendPacket()
 {
-    if (ExperimentControlUDP::getInstance().getSwitchStatus() && ExperimentControlUDP::getInstance().getState() == 1 && ExperimentControlUDP::getInstance().getNumNodes() == ExperimentControlUDP::getInstance().getNumReady()) {
+    if (drainPending) {
         return;
     }
 
     udpMsgTimes.push(simTime());
+    requestSent();
 
     std::ostringstream str;
     str << packetName << "-" << numSent;
@@ -388,6 +319,7 @@ void DFNodeUDP::processPacket(Packet *pk)
     emit(packetReceivedSignal, pk);
     EV_INFO << "Received packet: " << UdpSocket::getReceivedPacketInfo(pk) << endl;
     delete pk;
+    replyArrived();
 
     ExperimentControlUDP::getInstance().appendTotalPacketsLost((long)(numSent-numReceived) - packetsLost);
     if (packetsLost < numSent-numReceived) {
@@ -407,6 +339,7 @@ void DFNodeUDP::processPacket(Packet *pk)
 
         udpMsgTimes.pop();
     }
+    checkDrained();
 }
 
 void DFNodeUDP::setSocketOptions() {
@@ -17,6 +17,7 @@
 #define DFNODEUDP_H_
 
 #include "ExperimentControlUDP.h"
+#include "common/DirectRoles.h"
 #include "inet/common/INETDefs.h"
 
 #include "inet/applications/base/ApplicationBase.h"
@@ -32,12 +33,19 @@ using std::queue;
 
 namespace inet {
 
-class DFNodeUDP : public ApplicationBase, public UdpSocket::ICallback {
+class DFNodeUDP : public ApplicationBase, public UdpSocket::ICallback,
+                  public DirectParentRole<DFNodeUDP, UdpDirectTransport>,
+                  public DirectChildRole<DFNodeUDP, UdpDirectTransport> {
+
+    friend class DirectParentRole<DFNodeUDP, UdpDirectTransport>;
+    friend class DirectChildRole<DFNodeUDP, UdpDirectTransport>;
 
     private:
         simsignal_t directArrival;
         simsignal_t udpArrival;
-        bool ready = false;
+        bool ready = false; // drain reported to the controller
+        bool drainPending = false; // STOP_UDP received, no new packets until RESTART_UDP
+        bool socketDestroyed = false; // destroyed at COMMIT_UDP, rebound at RESTART_UDP
 
     protected:
         enum SelfMsgKinds { START = 1, SEND, STOP };
@@ -54,14 +62,11 @@ class DFNodeUDP : public ApplicationBase, public UdpSocket::ICallback {
         bool dontFragment = false;
         const char *packetName = nullptr;
 
-        vector<string> data;
-        const vector<string> DF1targets = {"SN1", "SN2"};
-        const vector<string> DF2targets = {"SN3", "SN4"};
+        SensorStore data; // readings received in direct mode
 
         const_simtime_t propagationDelay = 0.01;
         const_simtime_t frequency = 2;
 
-        simtime_t lastDirectMsgTime = 0;
         queue<simtime_t> udpMsgTimes;
 
         int numEchoed;
@@ -75,12 +80,7 @@ class DFNodeUDP : public ApplicationBase, public UdpSocket::ICallback {
         virtual void refreshDisplay() const override;
 
         void handleDirectMessage(cMessage *msg);
-        void saveData(cMessage* msg);
-
-        virtual void delayedMsgSend(cMessage* msg, int layer);
-        virtual void finalMsgSend(cMessage* msg, const char* mod, int layer);
-
-        void finalMsgSendRouter(cMessage* msg, const char* currentMod);
+        void checkDrained();
 
         virtual void handleStartOperation(LifecycleOperation *operation) override;
         virtual void handleStopOperation(LifecycleOperation *operation) override;
@@ -19,22 +19,126 @@ namespace inet {
 
 Define_Module(ExperimentControlUDP);
 
-void ExperimentControlUDP::initialize() {
-    cSimpleModule::initialize();
+Register_Enum(msg_kind, (APP_SELF_MSG, APP_SELF_MSG_CLIENT, APP_MSG_SENT, APP_MSG_RETURNED, INIT_TIMER, TIMER,
+        RESTART_UDP, STOP_UDP, ADAPT_TIMER, START_MSG, END_MSG, COMMIT_UDP, MIGRATED_REPLY, FORK_MSG, PARTITION_TOPOLOGY, PARTITION_DRAINED));
 
-    if (!par("hasSwitch")) {
-        sources.clear();
-        targets.clear();
+void ExperimentControlUDP::initialize(int stage) {
+    cSimpleModule::initialize(stage);
+
+    if (stage == INITSTAGE_LAST) {
+        // the application tree is read from resolved addresses, so it is built last
+        getInstance().graph.build(getSimulation()->getSystemModule());
+        getInstance().peers.reset(getSimulation()->getSystemModule(), "udp");
+        hasSwitch = par("hasSwitch");
+        collectEndpoints();
+
+        partitions.build(this);
+        numTopologies = 0;
+        if (partitions.isPartitioned()) {
+            checkPartitions();
+            // the other replicas learn the links of this partition one lookahead later
+            scheduleAt(SIMTIME_ZERO, new cMessage("partition_topology", msg_kind::PARTITION_TOPOLOGY));
+        }
+
+        prepareLayers();
+        runStart = std::chrono::steady_clock::now();
+        return;
     }
+    if (stage != INITSTAGE_LOCAL)
+        return;
 
     delete udpMsgStats;
     delete directMsgStats;
     udpMsgStats = getInstance().udpMsgStats;
     directMsgStats = getInstance().directMsgStats;
-    setState();
+
+    currentLayer = par("currentLayer");
+    drainTimeout = par("drainTimeout");
+    getInstance().state = currentLayer;
+    getInstance().currentLayer = currentLayer;
+    getInstance().switchActive = false;
+    getInstance().nodeWindow.clear();
+    getInstance().fidelityGeneration++;
+    getInstance().nodeNewLayer.clear();
+    getInstance().barriers.clear();
+    getInstance().controller = this;
+    InstrumentedScheduler::setFidelityProbe([](const char *host) { return host != nullptr ? getInstance().getState(host) : getInstance().getState(); }, "msg_kind");
+    getInstance().flows.clear();
+    getInstance().messages = new MessagePool("messagePool", par("messagePoolSize").intValue());
+    flowTimer = new cMessage("flow_completion");
+
+    const char *delayModel = par("delayModel");
+    if (strcmp(delayModel, "calibrated") == 0)
+        getInstance().calibrateDelays = true;
+    else if (strcmp(delayModel, "constant") == 0)
+        getInstance().calibrateDelays = false;
+    else
+        throw cRuntimeError("Unknown delayModel \"%s\"", delayModel);
+    getInstance().delays.configure(par("delaySamples").intValue(), par("minDelaySamples").intValue());
+    getInstance().directLoss = par("directLoss");
+    getInstance().directJitter = par("directJitter");
+    getInstance().directBatching = par("directBatching");
+    getInstance().batches.clear();
+    getInstance().directMessagesLost = 0;
+    getInstance().migrateInFlight = par("migrateInFlight");
+    getInstance().migratedReplies = 0;
+
+    const char *mode = par("mode");
+    if (strcmp(mode, "adaptive") == 0) {
+        adaptive = true;
+        if (par("forkAt").doubleValue() >= 0)
+            throw cRuntimeError("forkAt needs mode = \"schedule\"");
+        adaptiveLayer = par("adaptiveLayer");
+        wallClockBudget = par("wallClockBudget");
+        headroomFactor = par("headroomFactor");
+        minDwellTime = par("minDwellTime");
+        accuracyCheckInterval = par("accuracyCheckInterval");
+        accuracyCheckDuration = par("accuracyCheckDuration");
+        if (adaptiveLayer < 0 || adaptiveLayer > 2)
+            throw cRuntimeError("Layer %d is not supported by the UDP network", adaptiveLayer);
+        regions.parse(par("regions"));
+        adaptiveWindow.region = par("adaptiveRegion").stdstringValue();
+        if (!regions.has(adaptiveWindow.region))
+            throw cRuntimeError("Unknown adaptiveRegion \"%s\"", adaptiveWindow.region.c_str());
+        if (headroomFactor > 1)
+            throw cRuntimeError("headroomFactor must not exceed 1");
+        // no further switch is taken while a drain is pending, so it must end
+        if (drainTimeout < SIMTIME_ZERO)
+            throw cRuntimeError("mode = \"adaptive\" needs a non-negative drainTimeout");
+    } else if (strcmp(mode, "schedule") == 0) {
+        readSchedule();
+        setState();
+        forkAt = par("forkAt");
+        if (forkAt >= SIMTIME_ZERO)
+            scheduleFork();
+    } else {
+        throw cRuntimeError("Unknown mode \"%s\"", mode);
+    }
+
+    clockSampleInterval = par("clockSampleInterval");
+    wallTimes.setName("wallTimes");
+    cpuTimes.setName("cpuTimes");
+    eventCounts.setName("eventCounts");
+    packetsLost.setName("packetLost");
+    InstrumentedScheduler *scheduler = dynamic_cast<InstrumentedScheduler *>(getSimulation()->getScheduler());
+    if (scheduler != nullptr && clockSampleInterval > SIMTIME_ZERO)
+        scheduler->sampleClock(this, clockSampleInterval);
+    else if (adaptive)
+        throw cRuntimeError("mode = \"adaptive\" needs scheduler-class = \"inet::InstrumentedScheduler\" and a positive clockSampleInterval");
+    if (adaptive) {
+        adaptTimer = new cMessage("adapt_timer", msg_kind::ADAPT_TIMER);
+        scheduleAt(SIMTIME_ZERO, adaptTimer);
+    }
 }
 
 ExperimentControlUDP::~ExperimentControlUDP() {
+    cancelAndDelete(flowTimer);
+    cancelAndDelete(adaptTimer);
+    if (getInstance().controller == this) {
+        delete getInstance().messages;
+        getInstance().messages = nullptr;
+        getInstance().controller = nullptr;
+    }
     delete udpMsgStats;
     delete directMsgStats;
     udpMsgStats = nullptr;
@@ -42,62 +146,238 @@ ExperimentControlUDP::~ExperimentControlUDP() {
 }
 
 void ExperimentControlUDP::handleMessage(cMessage* msg) {
-    if (msg->getKind() == msg_kind::START_MSG && msg->isSelfMessage()) {
-        getInstance().state = newLayer;
-        getInstance().switchActive = true;
+    const FidelityWindow *window = static_cast<const FidelityWindow *>(msg->getContextPointer());
+    if (msg == flowTimer) {
+        deliverFlows();
+    } else if (msg == adaptTimer) {
+        // the scheduler sampled the clocks just before this event
+        adaptFidelity(lastClock.wallTime);
+        scheduleAt(simTime() + clockSampleInterval, adaptTimer);
+    } else if (msg->getKind() == msg_kind::START_MSG && msg->isSelfMessage()) {
+        enterWindow(*window);
         delete msg;
     } else if (msg->getKind() == msg_kind::END_MSG && msg->isSelfMessage()) {
-        getInstance().switchActive = false;
+        leaveWindow(*window);
+        transitionPending = false;
+        delete msg;
+    } else if (msg->getKind() == msg_kind::FORK_MSG && msg->isSelfMessage()) {
+        delete msg;
+        forkBranches();
+    } else if (msg->getKind() == msg_kind::PARTITION_TOPOLOGY && msg->isSelfMessage()) {
         delete msg;
+        sendTopology();
+    } else if (msg->arrivedOn("peerIn")) {
+        receiveFromPartition(msg);
+    } else if (msg->getKind() == msg_kind::INIT_TIMER && msg->isSelfMessage()) {
+        // drain deadline passed, e.g. because a reply was lost
+        drainDeadlines.erase(window);
+        delete msg;
+        EV_WARN << "targets of the window starting at " << window->start << " did not drain within " << drainTimeout << ", switching anyway" << endl;
+        commitWindow(*window);
+    } else {
+        delete msg;
+    }
+}
+
+cMessage *ExperimentControlUDP::acquireMessage(const char *name, short kind) {
+    MessagePool *pool = getInstance().messages;
+    return pool ? pool->acquire(name, kind) : new cMessage(name, kind);
+}
 
-        if (getInstance().state == 1) {
-            msg = new cMessage("restart_udp", msg_kind::RESTART_UDP);
-            sendToTargets(msg);
-            delete msg;
-        } else if (getInstance().state == 2) {
-            cMessage* startMsg = new cMessage("start_L4", msg_kind_transport::L4_START);
-            sendToTargets(startMsg);
-            sendToSources(startMsg);
-            delete msg;
+void ExperimentControlUDP::releaseMessage(cMessage *msg) {
+    MessagePool *pool = getInstance().messages;
+    if (pool)
+        pool->release(msg);
+    else
+        delete msg;
+}
+
+bool ExperimentControlUDP::isBatched(const char *node) const {
+    return getInstance().directBatching && getState(node) == 1;
+}
+
+void ExperimentControlUDP::postDirect(const char *node, int source, simtime_t sent, simtime_t arrival) {
+    getInstance().batches.post(getParent(node), source, sent, arrival);
+}
+
+vector<DirectRecord> ExperimentControlUDP::collectDirect(const char *node) {
+    return getInstance().batches.collect(node, simTime());
+}
+
+void ExperimentControlUDP::sendFlow(const char *from, const char *to, cMessage *msg) {
+    getInstance().controller->startFlowTransfer(from, to, msg);
+}
+
+void ExperimentControlUDP::startFlowTransfer(const char *from, const char *to, cMessage *msg) {
+    Enter_Method_Silent();
+    take(msg);
+    const RoutingGraph& graph = getInstance().graph;
+    bool up = graph.hasParent(from) && graph.getParent(from) == to;
+    string host = up ? from : to;
+    const DirectRoute& route = graph.getRoute(host);
+    getInstance().flows.add(simTime(), from, to, up ? route.up : route.down, 8 * getInstance().links.getMessageBytes(host, up), msg);
+    scheduleFlowTimer();
+}
+
+void ExperimentControlUDP::deliverFlows() {
+    for (const FlowEngine::Delivery& delivery : getInstance().flows.collect(simTime())) {
+        const DirectPeer& peer = getPeer(delivery.destination);
+        sendDirect(delivery.msg, delivery.propagationDelay, 0, peer.app, peer.appInGateId);
+    }
+    scheduleFlowTimer();
+}
+
+void ExperimentControlUDP::scheduleFlowTimer() {
+    cancelEvent(flowTimer);
+    simtime_t next = getInstance().flows.getNextCompletion();
+    if (next >= SIMTIME_ZERO)
+        scheduleAt(std::max(next, simTime()), flowTimer);
+}
+
+void ExperimentControlUDP::enterWindow(const FidelityWindow& window) {
+    if (partitions.isPartitioned() && numTopologies < partitions.getNumPartitions() - 1)
+        throw cRuntimeError("The window at %s starts before all partitions have reported their links, one lookahead into the run", window.start.str().c_str());
+    getInstance().fidelityGeneration++;
+    // the other end of a link may be a host of another partition
+    auto enter = [&](const string& node) {
+        if (regions.contains(window.region, node)) {
+            getInstance().nodeWindow[node] = &window;
+            getInstance().nodeNewLayer[node] = window.layer;
         }
+    };
+    for (const string& node : sources) {
+        enter(node);
+        for (const string& child : getChildren(node.c_str()))
+            enter(child);
+    }
+    for (const string& node : targets) {
+        enter(node);
+        enter(getParent(node.c_str()));
+    }
+    activeWindows.insert(&window);
+    getInstance().state = window.layer;
+    getInstance().switchActive = true;
 
-        getInstance().state = currentLayer;
+    // only the application levels drain before the window is in effect
+    if (!isApplicationLevel(window.layer))
+        transitionPending = false;
+    if (isApplicationLevel(window.layer)) {
+        // targets stop sending and report back once their last packet is answered
+        WindowBarrier& barrier = getInstance().barriers[&window];
+        barrier = WindowBarrier();
+        barrier.numNodes = getWindowTargets(window).size();
+        cMessage* stopMsg = acquireMessage("stop_udp", msg_kind::STOP_UDP);
+        sendToTargets(stopMsg, window);
+        releaseMessage(stopMsg);
 
-    } else if (msg->getKind() == msg_kind::INIT_TIMER && msg->isSelfMessage()) {
-        if ((!getInstance().getSwitchStatus() && simTime() < end_time)) {
-            // to make sure timeout arrives after route has been switched
-            scheduleAt(simTime() + 0.01, msg);
-        } else {
-            if (getInstance().state == 1) {
-                if (!stopSent) {
-                    cMessage* stopMsg = new cMessage("stop_udp", msg_kind::STOP_UDP);
-                    sendToTargets(stopMsg);
-                    stopSent = true;
-                    delete stopMsg;
-                }
-
-                if (getInstance().getNumNodes() == getInstance().getNumReady()) {
-                    sendToSources(msg);
-                    delete msg;
-                } else {
-                    scheduleAt(simTime() + 0.01, msg);
-                }
-
-            } else if (getInstance().state == 2) {
-                cMessage* stopMsg = new cMessage("stop_L4", msg_kind_transport::L4_STOP);
-                sendToTargets(stopMsg);
-                sendToSources(stopMsg);
-                delete stopMsg;
-                delete msg;
-            }
+        if (drainTimeout >= SIMTIME_ZERO) {
+            cMessage *deadline = new cMessage("drain_timeout", msg_kind::INIT_TIMER);
+            deadline->setContextPointer(const_cast<FidelityWindow *>(&window));
+            drainDeadlines[&window] = deadline;
+            scheduleAt(simTime() + drainTimeout, deadline);
         }
-    } else {
-        delete msg;
+        checkBarrier(window);
+    } else if (window.layer == 2) {
+        cMessage* stopMsg = new cMessage("stop_L4", msg_kind_transport::L4_STOP);
+        sendToTargets(stopMsg, window);
+        sendToSources(stopMsg, window);
+        delete stopMsg;
+    }
+}
+
+void ExperimentControlUDP::reportDrained(const char *node) {
+    auto window = getInstance().nodeWindow.find(node);
+    if (window != getInstance().nodeWindow.end() && getInstance().controller)
+        getInstance().controller->windowDrained(*window->second);
+}
+
+bool ExperimentControlUDP::getMigratedArrival(const char *node, simtime_t sent, simtime_t fallback, simtime_t& arrival) {
+    simtime_t up, down;
+    if (!sampleTransfer(node, true, up) || !sampleTransfer(node, false, down))
+        return false;
+    getInstance().migratedReplies++;
+    arrival = std::max(sent + getParentDelay(node, fallback) * 2, simTime()) + up + down;
+    return true;
+}
+
+void ExperimentControlUDP::windowDrained(const FidelityWindow& window) {
+    Enter_Method_Silent();
+    getInstance().barriers[&window].numNodesReady++;
+    checkBarrier(window);
+}
+
+void ExperimentControlUDP::checkBarrier(const FidelityWindow& window) {
+    WindowBarrier& barrier = getInstance().barriers[&window];
+    if (barrier.committed || barrier.numNodesReady < barrier.numNodes)
+        return;
+    if (!barrier.reported && partitions.isPartitioned()) {
+        barrier.reported = true;
+        for (int i = 0; i < gateSize("peerOut"); i++) {
+            cMessage *msg = new cMessage("partition_drained", msg_kind::PARTITION_DRAINED);
+            msg->addPar("window") = (long)(&window - &schedule[0]);
+            send(msg, "peerOut", i);
+        }
+    }
+    if (barrier.numPartitionsReady >= partitions.getNumPartitions() - 1)
+        commitWindow(window);
+}
+
+void ExperimentControlUDP::commitWindow(const FidelityWindow& window) {
+    // the adaptive mode may switch again once the drain is over, or timed out
+    transitionPending = false;
+    transitionLatency.collect(simTime() - window.start);
+    getInstance().fidelityGeneration++;
+    getInstance().barriers[&window].committed = true;
+    auto deadline = drainDeadlines.find(&window);
+    if (deadline != drainDeadlines.end()) {
+        cancelAndDelete(deadline->second);
+        drainDeadlines.erase(deadline);
+    }
+
+    cMessage *commitMsg = acquireMessage("commit_udp", msg_kind::COMMIT_UDP);
+    sendToTargets(commitMsg, window);
+    releaseMessage(commitMsg);
+    cMessage *initMsg = acquireMessage("timeout", msg_kind::INIT_TIMER);
+    sendToSources(initMsg, window);
+    releaseMessage(initMsg);
+}
+
+void ExperimentControlUDP::leaveWindow(const FidelityWindow& window) {
+    getInstance().fidelityGeneration++;
+    for (auto it = getInstance().nodeWindow.begin(); it != getInstance().nodeWindow.end(); ) {
+        if (it->second == &window)
+            it = getInstance().nodeWindow.erase(it);
+        else
+            ++it;
+    }
+    activeWindows.erase(&window);
+    getInstance().switchActive = !activeWindows.empty();
+    if (!getInstance().switchActive)
+        getInstance().state = currentLayer;
+
+    if (isApplicationLevel(window.layer)) {
+        cMessage *restartMsg = acquireMessage("restart_udp", msg_kind::RESTART_UDP);
+        sendToTargets(restartMsg, window);
+        releaseMessage(restartMsg);
+    } else if (window.layer == 2) {
+        cMessage* startMsg = new cMessage("start_L4", msg_kind_transport::L4_START);
+        sendToTargets(startMsg, window);
+        sendToSources(startMsg, window);
+        delete startMsg;
+    }
+
+    // nodes re-arm their readiness on restart, so the next window needs a fresh count
+    getInstance().barriers.erase(&window);
+    auto deadline = drainDeadlines.find(&window);
+    if (deadline != drainDeadlines.end()) {
+        cancelAndDelete(deadline->second);
+        drainDeadlines.erase(deadline);
     }
 }
 
-int ExperimentControlUDP::getNewLayer() const {
-    return getInstance().newLayer;
+int ExperimentControlUDP::getNewLayer(const char *node) const {
+    auto it = getInstance().nodeNewLayer.find(node);
+    return it != getInstance().nodeNewLayer.end() ? it->second : getInstance().currentLayer;
 }
 
 int ExperimentControlUDP::getState() const {
@@ -108,64 +388,419 @@ bool ExperimentControlUDP::getSwitchStatus() const {
     return getInstance().switchActive;
 }
 
-void ExperimentControlUDP::setState() {
-    if (currentLayer == newLayer) return;
-    cMessage* startMsg = new cMessage("start_msg", msg_kind::START_MSG);
-    cMessage* endMsg = new cMessage("end_msg", msg_kind::END_MSG);
-    cMessage* timeout = new cMessage("timeout", msg_kind::INIT_TIMER);
-    scheduleAt(start_time, startMsg);
-    scheduleAt(end_time, endMsg);
-    scheduleAt(start_time, timeout);
-}
-
-void ExperimentControlUDP::sendToSources(cMessage *msg) {
-    if (getInstance().state == 1) {
-        for (std::string s : sources) {
-            std::string targetPath("UDPnetworksim." + s + ".app[0]");
-            sendDirect(new cMessage("sending", msg->getKind()), getModuleByPath(targetPath.c_str()), "appIn");
+int ExperimentControlUDP::getState(const char *node) const {
+    auto it = getInstance().nodeWindow.find(node);
+    return it != getInstance().nodeWindow.end() ? it->second->layer : getInstance().currentLayer;
+}
+
+bool ExperimentControlUDP::getSwitchStatus(const char *node) const {
+    return getInstance().nodeWindow.count(node) > 0;
+}
+
+cModule *ExperimentControlUDP::findHost(const L3Address& address) {
+    return getInstance().graph.findHost(address);
+}
+
+const DirectPeer& ExperimentControlUDP::getPeer(const string& host) {
+    return getInstance().peers.get(host);
+}
+
+void ExperimentControlUDP::sendToPartition(const DirectPeer& peer, cMessage *msg, simtime_t delay) {
+    getInstance().controller->forwardToPartition(peer, msg, delay);
+}
+
+void ExperimentControlUDP::forwardToPartition(const DirectPeer& peer, cMessage *msg, simtime_t delay) {
+    Enter_Method_Silent();
+    take(msg);
+    int gate = partitions.getGate(peer.host);
+    if (delay < partitions.getLookahead(gate))
+        throw cRuntimeError("Direct message to %s is due in %s, less than the lookahead %s towards its partition",
+                peer.host->getFullName(), delay.str().c_str(), partitions.getLookahead(gate).str().c_str());
+    // the receiving controller delivers it at the timestamp
+    msg->setName(peer.host->getFullName());
+    msg->setTimestamp(simTime() + delay);
+    send(msg, "peerOut", gate);
+}
+
+void ExperimentControlUDP::receiveFromPartition(cMessage *msg) {
+    if (msg->getKind() == msg_kind::PARTITION_TOPOLOGY) {
+        cArray& links = msg->getParList();
+        for (int i = 0; i < links.size(); i++) {
+            cMsgPar *link = check_and_cast<cMsgPar *>(links[i]);
+            getInstance().graph.addRemoteLink(link->getName(), link->stringValue());
         }
-    } else if (getInstance().state == 2) {
-        for (std::string s : sources) {
-            std::string targetPath("UDPnetworksim." + s + ".udp");
-            sendDirect(new cMessage("sending", msg->getKind()), getModuleByPath(targetPath.c_str()), "transportIn");
+        numTopologies++;
+        collectEndpoints();
+        delete msg;
+    } else if (msg->getKind() == msg_kind::PARTITION_DRAINED) {
+        const FidelityWindow& window = schedule[msg->par("window").longValue()];
+        delete msg;
+        // a window shorter than the lookahead may be over by now
+        if (activeWindows.count(&window)) {
+            getInstance().barriers[&window].numPartitionsReady++;
+            checkBarrier(window);
         }
+    } else {
+        // a direct message for a local app
+        const DirectPeer& peer = getPeer(msg->getName());
+        simtime_t arrival = msg->getTimestamp();
+        msg->setName(nullptr);
+        msg->setTimestamp(SIMTIME_ZERO);
+        sendDirect(msg, arrival - simTime(), 0, peer.app, peer.appInGateId);
     }
 }
 
-void ExperimentControlUDP::sendToTargets(cMessage *msg) {
-    if (getInstance().state == 1) {
-        for (std::string s : targets) {
-            std::string targetPath("UDPnetworksim." + s + ".app[0]");
-            sendDirect(new cMessage("sending", msg->getKind()), getModuleByPath(targetPath.c_str()), "appIn");
+void ExperimentControlUDP::sendTopology() {
+    const RoutingGraph& graph = getInstance().graph;
+    cMessage *msg = new cMessage("partition_topology", msg_kind::PARTITION_TOPOLOGY);
+    for (const auto& link : graph.getParents()) {
+        if (graph.hasRoute(link.first)) // child in this partition
+            msg->addPar(link.first.c_str()) = link.second.c_str();
+    }
+    for (int i = 0; i < gateSize("peerOut"); i++)
+        send(i == gateSize("peerOut") - 1 ? msg : msg->dup(), "peerOut", i);
+}
+
+void ExperimentControlUDP::collectEndpoints() {
+    const RoutingGraph& graph = getInstance().graph;
+    sources.clear();
+    targets.clear();
+    if (!hasSwitch)
+        return;
+    for (const string& host : graph.getHosts()) {
+        if (!graph.getChildren(host).empty())
+            sources.push_back(host);
+        if (graph.hasParent(host))
+            targets.push_back(host);
+    }
+    // resolve the endpoints of all hosts taking part in switches up front
+    for (const vector<string> *nodes : {&sources, &targets}) {
+        for (const string& node : *nodes)
+            getPeer(node);
+    }
+}
+
+void ExperimentControlUDP::checkPartitions() const {
+    if (adaptive)
+        throw cRuntimeError("mode = \"adaptive\" cannot run in parallel, each partition would follow its own wall clock");
+    if (forkAt >= SIMTIME_ZERO)
+        throw cRuntimeError("forkAt cannot be used in a parallel run");
+    if (getInstance().directBatching)
+        throw cRuntimeError("directBatching collects the answers at the parent's controller and cannot run in parallel");
+    if (getInstance().directLoss || getInstance().directJitter)
+        throw cRuntimeError("directLoss and directJitter need both directions of a link in one partition and cannot run in parallel");
+
+    // only layer 1 carries messages between partitions, through the controllers
+    cModule *network = getSimulation()->getSystemModule();
+    for (const string& host : targets) {
+        cModule *parent = network->getModuleByPath(("." + getParent(host.c_str())).c_str());
+        if (!parent->isPlaceholder())
+            continue;
+        for (size_t i = 0; i < schedule.size(); i++) {
+            const FidelityWindow& window = schedule[i];
+            if (window.layer != currentLayer && window.layer != 1 && regions.contains(window.region, host) && regions.contains(window.region, parent->getFullName()))
+                throw cRuntimeError("The window at %s switches the link from %s to %s, which crosses partitions, to layer %d; only layer 1 can cross partitions",
+                        window.start.str().c_str(), host.c_str(), parent->getFullName(), window.layer);
+        }
+    }
+}
+
+const string& ExperimentControlUDP::getParent(const char *node) const {
+    return getInstance().graph.getParent(node);
+}
+
+const vector<string>& ExperimentControlUDP::getChildren(const char *node) const {
+    return getInstance().graph.getChildren(node);
+}
+
+simtime_t ExperimentControlUDP::getParentDelay(const char *node, simtime_t fallback) {
+    if (!getInstance().calibrateDelays)
+        return fallback;
+    return getInstance().delays.sample(node, getParent(node), fallback, getInstance().controller->getRNG(0));
+}
+
+simtime_t ExperimentControlUDP::getChildDelay(const char *node, simtime_t fallback) {
+    if (!getInstance().calibrateDelays)
+        return fallback;
+    vector<const string*> directChildren;
+    for (const string& child : getChildren(node)) {
+        if (isDirectLink(child.c_str()))
+            directChildren.push_back(&child);
+    }
+    if (directChildren.empty())
+        return fallback;
+    cRNG *rng = getInstance().controller->getRNG(0);
+    const string& child = *directChildren[intuniform(rng, 0, directChildren.size() - 1)];
+    return getInstance().delays.sample(node, child, fallback, rng);
+}
+
+bool ExperimentControlUDP::sampleTransfer(const char *node, bool up, simtime_t& delay) {
+    ExperimentControlUDP& instance = getInstance();
+    cRNG *rng = instance.controller->getRNG(0);
+    delay = 0;
+    if (instance.directLoss && instance.links.sampleLostPackets(node, up, instance.links.getNumPackets(node, up), rng) > 0) {
+        instance.directMessagesLost++;
+        appendTotalPacketsLost(1);
+        return false;
+    }
+    if (instance.directJitter)
+        delay = instance.links.sampleJitter(node, up, rng);
+    return true;
+}
+
+bool ExperimentControlUDP::isDirectLink(const char *node) const {
+    const std::map<string, const FidelityWindow*>& nodeWindow = getInstance().nodeWindow;
+    auto parent = getInstance().graph.getParents().find(node);
+    if (parent == getInstance().graph.getParents().end())
+        return false;
+    auto window = nodeWindow.find(node);
+    auto parentWindow = nodeWindow.find(parent->second);
+    return window != nodeWindow.end() && parentWindow != nodeWindow.end() && window->second == parentWindow->second && isApplicationLevel(window->second->layer);
+}
+
+bool ExperimentControlUDP::hasPacketLevelChildren(const char *node) const {
+    for (const string& child : getChildren(node)) {
+        if (!isDirectLink(child.c_str()))
+            return true;
+    }
+    return false;
+}
+
+void ExperimentControlUDP::setState() {
+    for (size_t i = 0; i < schedule.size(); i++) {
+        const FidelityWindow& window = schedule[i];
+        // windows that keep the current fidelity need no transition
+        if (window.layer == currentLayer)
+            continue;
+        scheduleTransition("start_msg", msg_kind::START_MSG, window.start, window);
+        scheduleTransition("end_msg", msg_kind::END_MSG, window.end, window);
+    }
+}
+
+void ExperimentControlUDP::scheduleTransition(const char *name, short int kind, simtime_t time, const FidelityWindow& window) {
+    cMessage *msg = new cMessage(name, kind);
+    msg->setContextPointer(const_cast<FidelityWindow *>(&window));
+    scheduleAt(time, msg);
+}
+
+void ExperimentControlUDP::scheduleFork() {
+    if (ForkPoint::parseBranches(par("forkSchedules")).empty())
+        throw cRuntimeError("forkAt is set, but forkSchedules has no branch");
+    for (size_t i = 0; i < schedule.size(); i++) {
+        if (schedule[i].start < forkAt && forkAt < schedule[i].end)
+            throw cRuntimeError("forkAt %s lies inside the window %s..%s, the branches must start at full fidelity",
+                    forkAt.str().c_str(), schedule[i].start.str().c_str(), schedule[i].end.str().c_str());
+    }
+    cMessage *msg = new cMessage("fork", msg_kind::FORK_MSG);
+    msg->setSchedulingPriority(-1); // before the transitions at the same time
+    scheduleAt(forkAt, msg);
+}
+
+void ExperimentControlUDP::forkBranches() {
+    vector<string> branches = ForkPoint::parseBranches(par("forkSchedules"));
+    int branch = forks.fork(branches.size(), par("forkDirectory"));
+    if (branch == 0) {
+        EV_INFO << "forked " << branches.size() << " branches, continuing with fidelitySchedule" << endl;
+        return;
+    }
+
+    // windows that have not started yet are replaced by those of the branch; a window
+    // ending right here keeps its END_MSG
+    std::set<void *> replaced;
+    vector<cMessage *> transitions;
+    cFutureEventSet *fes = getSimulation()->getFES();
+    for (int i = 0; i < fes->getLength(); i++) {
+        cMessage *msg = dynamic_cast<cMessage *>(fes->get(i));
+        if (!msg || msg->getArrivalModule() != this)
+            continue;
+        if (msg->getKind() == msg_kind::START_MSG)
+            replaced.insert(msg->getContextPointer());
+        if (msg->getKind() == msg_kind::START_MSG || msg->getKind() == msg_kind::END_MSG)
+            transitions.push_back(msg);
+    }
+    for (cMessage *msg : transitions) {
+        if (replaced.count(msg->getContextPointer()))
+            cancelAndDelete(msg);
+    }
+
+    branchSchedule.parse(branches[branch - 1].c_str());
+    branchSchedule.validate(regions);
+    checkLayers(branchSchedule);
+    for (size_t i = 0; i < branchSchedule.size(); i++) {
+        const FidelityWindow& window = branchSchedule[i];
+        if (window.start < simTime())
+            throw cRuntimeError("Branch %d has a window starting at %s, before the fork", branch, window.start.str().c_str());
+        if (window.layer == currentLayer)
+            continue;
+        scheduleTransition("start_msg", msg_kind::START_MSG, window.start, window);
+        scheduleTransition("end_msg", msg_kind::END_MSG, window.end, window);
+    }
+    prepareLayers();
+    EV_INFO << "continuing as branch " << branch << " with \"" << branches[branch - 1] << "\"" << endl;
+}
+
+void ExperimentControlUDP::clockSampled(const InstrumentedScheduler::ClockSample& sample) {
+    Enter_Method_Silent();
+    lastClock = sample;
+    wallTimes.recordWithTimestamp(sample.time, sample.wallTime);
+    cpuTimes.recordWithTimestamp(sample.time, sample.cpuTime);
+    eventCounts.recordWithTimestamp(sample.time, sample.events);
+    packetsLost.recordWithTimestamp(sample.time, getInstance().getTotalPacketsLost());
+}
+
+void ExperimentControlUDP::adaptFidelity(double elapsed) {
+    Enter_Method_Silent();
+    if (!adaptive || transitionPending || simTime() <= SIMTIME_ZERO)
+        return;
+
+    // hysteresis: stay at a level for at least minDwellTime
+    if (simTime() - lastSwitchTime < minDwellTime)
+        return;
+
+    // cumulative ratio, so that the whole run stays within budget * sim-time-limit
+    double ratio = elapsed / SIMTIME_DBL(simTime());
+    if (!getSwitchStatus()) {
+        if (ratio > wallClockBudget && simTime() >= accuracyCheckUntil) {
+            EV_INFO << "wall-clock ratio " << ratio << " over budget " << wallClockBudget << ", switching to layer " << adaptiveLayer << endl;
+            beginAbstraction(adaptiveLayer);
+        }
+    } else if (accuracyCheckInterval >= SIMTIME_ZERO && simTime() - lastSwitchTime >= accuracyCheckInterval) {
+        EV_INFO << "accuracy check, returning to layer " << currentLayer << " for " << accuracyCheckDuration << endl;
+        accuracyCheckUntil = simTime() + accuracyCheckDuration;
+        endAbstraction();
+    } else if (ratio < wallClockBudget * headroomFactor) {
+        EV_INFO << "wall-clock ratio " << ratio << " has headroom, returning to layer " << currentLayer << endl;
+        endAbstraction();
+    }
+}
+
+void ExperimentControlUDP::beginAbstraction(int layer) {
+    adaptiveWindow.start = simTime();
+    adaptiveWindow.end = SimTime::getMaxTime();
+    adaptiveWindow.layer = layer;
+    lastSwitchTime = simTime();
+    transitionPending = true;
+    scheduleTransition("start_msg", msg_kind::START_MSG, simTime(), adaptiveWindow);
+}
+
+void ExperimentControlUDP::endAbstraction() {
+    lastSwitchTime = simTime();
+    transitionPending = true;
+    scheduleTransition("end_msg", msg_kind::END_MSG, simTime(), adaptiveWindow);
+}
+
+void ExperimentControlUDP::readSchedule() {
+    regions.parse(par("regions"));
+
+    cXMLElement *scheduleFile = par("fidelityScheduleFile").xmlValue();
+    if (scheduleFile && scheduleFile->hasChildren()) {
+        schedule.parse(scheduleFile);
+    } else {
+        schedule.parse(par("fidelitySchedule").stringValue());
+    }
+    schedule.validate(regions);
+
+    checkLayers(schedule);
+}
+
+void ExperimentControlUDP::checkLayers(const FidelitySchedule& windows) const {
+    for (size_t i = 0; i < windows.size(); i++) {
+        if (windows[i].layer != currentLayer && (windows[i].layer < 0 || windows[i].layer > 2)) {
+            throw cRuntimeError("Layer %d is not supported by the UDP network", windows[i].layer);
         }
-    } else if (getInstance().state == 2) {
-        for (std::string s : targets) {
-            std::string targetPath("UDPnetworksim." + s + ".udp");
-            sendDirect(new cMessage("sending", msg->getKind()), getModuleByPath(targetPath.c_str()), "transportIn");
+    }
+}
+
+void ExperimentControlUDP::prepareLayers() {
+    if (getInstance().directLoss || getInstance().directJitter || usesLayer(0))
+        getInstance().links.build(getSimulation()->getSystemModule(), getInstance().graph);
+}
+
+bool ExperimentControlUDP::usesLayer(int layer) const {
+    if (adaptive)
+        return adaptiveLayer == layer;
+    for (const FidelitySchedule *windows : {&schedule, &branchSchedule}) {
+        for (size_t i = 0; i < windows->size(); i++) {
+            if ((*windows)[i].layer == layer)
+                return true;
         }
     }
+    return false;
 }
 
-int ExperimentControlUDP::getNumNodes() const {
-    return getInstance().numNodes;
+vector<string> ExperimentControlUDP::getWindowTargets(const FidelityWindow& window) const {
+    vector<string> windowTargets;
+    for (const string& s : targets) {
+        if (regions.contains(window.region, s) && regions.contains(window.region, getParent(s.c_str())))
+            windowTargets.push_back(s);
+    }
+    return windowTargets;
 }
 
-int ExperimentControlUDP::getNumReady() const {
-    return getInstance().numNodesReady;
+vector<string> ExperimentControlUDP::getWindowSources(const FidelityWindow& window) const {
+    // the children need not be local
+    vector<string> windowSources;
+    for (const string& s : sources) {
+        if (!regions.contains(window.region, s))
+            continue;
+        for (const string& child : getChildren(s.c_str())) {
+            if (regions.contains(window.region, child)) {
+                windowSources.push_back(s);
+                break;
+            }
+        }
+    }
+    return windowSources;
 }
 
-void ExperimentControlUDP::incrementNumNodes() {
-    ++getInstance().numNodes;
+void ExperimentControlUDP::sendToSources(cMessage *msg, const FidelityWindow& window) {
+    vector<string> windowSources = getWindowSources(window);
+    if (isApplicationLevel(window.layer)) {
+        for (std::string s : windowSources) {
+            const DirectPeer& peer = getPeer(s);
+            sendDirect(acquireMessage("sending", msg->getKind()), peer.app, peer.appInGateId);
+        }
+    } else if (window.layer == 2) {
+        for (std::string s : windowSources) {
+            const DirectPeer& peer = getPeer(s);
+            sendDirect(new cMessage("sending", msg->getKind()), peer.transport, peer.transportInGateId);
+        }
+    }
+}
+
+void ExperimentControlUDP::sendToTargets(cMessage *msg, const FidelityWindow& window) {
+    vector<string> windowTargets = getWindowTargets(window);
+    if (isApplicationLevel(window.layer)) {
+        for (std::string s : windowTargets) {
+            const DirectPeer& peer = getPeer(s);
+            sendDirect(acquireMessage("sending", msg->getKind()), peer.app, peer.appInGateId);
+        }
+    } else if (window.layer == 2) {
+        for (std::string s : windowTargets) {
+            const DirectPeer& peer = getPeer(s);
+            sendDirect(new cMessage("sending", msg->getKind()), peer.transport, peer.transportInGateId);
+        }
+    }
 }
 
-void ExperimentControlUDP::incrementNumReady() {
-    ++getInstance().numNodesReady;
+bool ExperimentControlUDP::isWindowReady(const char *node) const {
+    auto window = getInstance().nodeWindow.find(node);
+    if (window == getInstance().nodeWindow.end())
+        return false;
+    auto barrier = getInstance().barriers.find(window->second);
+    return barrier != getInstance().barriers.end() && barrier->second.committed;
 }
 
 void ExperimentControlUDP::addUdpStats(simtime_t previousTime, simtime_t currentTime) {
     udpMsgStats->collect(SIMTIME_DBL(currentTime) - SIMTIME_DBL(previousTime));
 }
 
+void ExperimentControlUDP::addRoundTrip(const char *node, simtime_t sent, simtime_t arrival) {
+    // only what the packet-level model measured, not a window's abstractions
+    if (getInstance().calibrateDelays && !getSwitchStatus(node))
+        getInstance().delays.collect(node, getParent(node), SIMTIME_DBL(arrival) - SIMTIME_DBL(sent), getInstance().controller->getRNG(0));
+}
+
 void ExperimentControlUDP::addDirectStats(simtime_t previousTime, simtime_t currentTime) {
     directMsgStats->collect(SIMTIME_DBL(currentTime) - SIMTIME_DBL(previousTime));
 }
@@ -179,6 +814,14 @@ long ExperimentControlUDP::getTotalPacketsLost() const {
 }
 
 void ExperimentControlUDP::finish() {
+    // merged over replications by simulations/replicate.py
+    recordStatistic(getInstance().udpMsgStats);
+    recordStatistic(getInstance().directMsgStats);
+    recordStatistic(&transitionLatency);
+    recordScalar("events", getSimulation()->getEventNumber());
+    recordScalar("simulatedTime", simTime(), "s");
+    recordScalar("runWallTime", std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count(), "s");
+
     EV << "UDP time:" << endl;
     EV << "     Mean: " << getInstance().udpMsgStats->getMean() << endl;
     EV << "     Min:  " << getInstance().udpMsgStats->getMin() << endl;
@@ -187,6 +830,20 @@ void ExperimentControlUDP::finish() {
     EV << "     Mean: " << getInstance().directMsgStats->getMean() << endl;
     EV << "     Min:  " << getInstance().directMsgStats->getMin() << endl;
     EV << "     Max:  " << getInstance().directMsgStats->getMax() << endl;
+    if (usesLayer(0))
+        EV << "Flow rate updates: " << getInstance().flows.getNumRateUpdates() << endl;
+    if (getInstance().messages)
+        EV << "Pooled messages: " << getInstance().messages->getNumCreated() << " created, " << getInstance().messages->getNumReused() << " reused" << endl;
+    if (getInstance().directBatching)
+        EV << "Batched direct messages: " << getInstance().batches.getNumPosted() << " in " << getInstance().batches.getNumBatches() << " batches, "
+           << getInstance().batches.getNumPending() << " never collected" << endl;
+    if (getInstance().directLoss)
+        EV << "Direct messages lost: " << getInstance().directMessagesLost << endl;
+    if (getInstance().migrateInFlight)
+        EV << "Migrated replies: " << getInstance().migratedReplies << endl;
+    if (forks.getBranch() > 0)
+        EV << "Branch " << forks.getBranch() << " of the fork at " << forkAt << endl;
+    forks.waitForBranches();
 }
 
 }
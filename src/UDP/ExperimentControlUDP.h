@@ -18,9 +18,28 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <chrono>
 #include <omnetpp.h>
 #include <inet/transportlayer/udp/pathTrackingUDP.h>
 
+#include "inet/common/INETDefs.h"
+
+#include "common/DelayModel.h"
+#include "common/DirectBatch.h"
+#include "common/DirectLinkModel.h"
+#include "common/DirectPeerRegistry.h"
+#include "common/FidelityRegions.h"
+#include "common/FidelitySchedule.h"
+#include "common/FlowEngine.h"
+#include "common/ForkPoint.h"
+#include "common/InstrumentedScheduler.h"
+#include "common/MessagePool.h"
+#include "common/PartitionMap.h"
+#include "common/RoutingGraph.h"
+
 using namespace omnetpp;
 using std::string;
 using std::vector;
@@ -34,35 +53,139 @@ enum msg_kind : short int {
     TIMER = 16,
     RESTART_UDP = 17,
     STOP_UDP = 18,
-    RECORD_TIME = 19,
+    ADAPT_TIMER = 19,
     START_MSG = 20,
     END_MSG = 21,
+    COMMIT_UDP = 22,
+    MIGRATED_REPLY = 23,
+    FORK_MSG = 24,
+    PARTITION_TOPOLOGY = 25,
+    PARTITION_DRAINED = 26,
 };
 
 namespace inet {
 
-class ExperimentControlUDP : public cSimpleModule {
+class ExperimentControlUDP : public cSimpleModule, public InstrumentedScheduler::IClockListener {
 
     private:
-        short int state = 5;
-        bool switchActive = false;
+        short int state = 5; // layer of the most recently entered window
+        bool switchActive = false; // true while any window is active
+        ExperimentControlUDP *controller = nullptr; // module instance driving the simulation
         long totalPacketsLost = 0;
-        int numNodes = 0;
-        int numNodesReady = 0;
 
-        bool stopSent = false;
+        std::map<string, const FidelityWindow*> nodeWindow; // active window of each switched node
+        long fidelityGeneration = 0; // bumped whenever a window is entered, committed or left
+        DirectPeerRegistry peers;
+        MessagePool *messages = nullptr; // owned by the controller module
+        RoutingGraph graph;
+        DelayModel delays; // learned from packet-level round trips if calibrateDelays
+        bool calibrateDelays = false;
+        DirectLinkModel links; // loss and jitter of the direct links, if directLoss or directJitter; message sizes of layer 0
+        FlowEngine flows; // layer 0
+        DirectBatch batches; // layer-1 answers waiting for their parent's next TIMER, if directBatching
+        bool directBatching = false;
+        bool directLoss = false;
+        bool directJitter = false;
+        long directMessagesLost = 0;
+        bool migrateInFlight = false;
+        long migratedReplies = 0;
+        std::map<string, int> nodeNewLayer; // layer of each node's current (or most recent) window
+
+        // targets of a window that have drained their UDP traffic
+        struct WindowBarrier {
+            int numNodes = 0;
+            int numNodesReady = 0;
+            int numPartitionsReady = 0; // other partitions whose targets have drained
+            bool reported = false; // the local targets have drained and the other partitions know
+            bool committed = false;
+        };
+        std::map<const FidelityWindow*, WindowBarrier> barriers;
 
     protected:
-        const int currentLayer = 5; // number of layers simulated initially
-        const int newLayer = 2; // number of layers simulated after switch
-        const_simtime_t start_time = 100;
-        const_simtime_t end_time = 200;
+        int currentLayer = 5; // number of layers simulated outside abstraction windows
+        FidelitySchedule schedule;
+        FidelityRegions regions;
+        std::set<const FidelityWindow*> activeWindows;
+
+        // recorded for simulations/benchmark.py
+        cHistogram transitionLatency {"transitionLatency"}; // simulated time from the start of a window until its direct traffic starts
+        std::chrono::steady_clock::time_point runStart; // end of initialization
+
+        // clocks of the run against simulated time, sampled by the scheduler without events;
+        // named in initialize(), so that only the module and not getInstance() registers them
+        simtime_t clockSampleInterval;
+        InstrumentedScheduler::ClockSample lastClock;
+        cOutVector wallTimes;
+        cOutVector cpuTimes;
+        cOutVector eventCounts;
+        cOutVector packetsLost;
+        FidelityWindow adaptiveWindow; // window entered and left by the adaptive mode
+        simtime_t drainTimeout; // commit after this long even if some targets have not drained
+        std::map<const FidelityWindow*, cMessage*> drainDeadlines;
+        cMessage *flowTimer = nullptr; // next message completed by the flow engine
+        bool hasSwitch = true;
+
+        // parallel runs: this controller is the replica of one partition, see common/PartitionMap.h
+        PartitionMap partitions;
+        int numTopologies = 0; // other partitions that have reported their links
+
+        // what-if branches forked at forkAt, see common/ForkPoint.h
+        simtime_t forkAt;
+        ForkPoint forks;
+        FidelitySchedule branchSchedule; // windows of this branch from forkAt on, replacing those of schedule
+
+        // wall-clock budget mode
+        bool adaptive = false;
+        int adaptiveLayer = 1;
+        double wallClockBudget = 0; // wall-clock seconds allowed per simulated second
+        double headroomFactor = 1;
+        simtime_t minDwellTime;
+        simtime_t accuracyCheckInterval;
+        simtime_t accuracyCheckDuration;
+        simtime_t lastSwitchTime = 0;
+        simtime_t accuracyCheckUntil = 0;
+        bool transitionPending = false; // from scheduling a switch until its window is committed or left
+        cMessage *adaptTimer = nullptr; // compares lastClock with the budget every clockSampleInterval
 
-        vector<string> sources = {"DF1", "DF2", "M"};
-        vector<string> targets = {"SN1", "SN2", "SN3", "SN4", "DF1", "DF2"};
+        vector<string> sources; // hosts with children in the routing graph
+        vector<string> targets; // hosts with a parent in the routing graph
 
-        virtual void initialize() override;
+        virtual int numInitStages() const override { return NUM_INIT_STAGES; }
+        virtual void initialize(int stage) override;
         virtual void handleMessage(cMessage* msg) override;
+
+        virtual void clockSampled(const InstrumentedScheduler::ClockSample& sample) override;
+        void adaptFidelity(double elapsed);
+        void beginAbstraction(int layer);
+        void endAbstraction();
+
+        void scheduleTransition(const char *name, short int kind, simtime_t time, const FidelityWindow& window);
+        void scheduleFork();
+        void forkBranches();
+        void checkLayers(const FidelitySchedule& windows) const;
+
+        // models needed by the layers of the schedule, once the application tree is known
+        void prepareLayers();
+        void startFlowTransfer(const char *from, const char *to, cMessage *msg);
+        void deliverFlows();
+        void scheduleFlowTimer();
+
+        void enterWindow(const FidelityWindow& window);
+        void leaveWindow(const FidelityWindow& window);
+        void windowDrained(const FidelityWindow& window);
+        void checkBarrier(const FidelityWindow& window);
+        void commitWindow(const FidelityWindow& window);
+
+        // sources and targets among the local hosts, again whenever links of other partitions become known
+        void collectEndpoints();
+        void checkPartitions() const;
+        void sendTopology();
+        void receiveFromPartition(cMessage *msg);
+        void forwardToPartition(const DirectPeer& peer, cMessage *msg, simtime_t delay);
+
+        // targets whose link to the parent lies inside the window's region, and the parents of those
+        vector<string> getWindowTargets(const FidelityWindow& window) const;
+        vector<string> getWindowSources(const FidelityWindow& window) const;
 
     public:
         static ExperimentControlUDP instance;
@@ -80,28 +203,96 @@ class ExperimentControlUDP : public cSimpleModule {
 
         int getState() const;
         bool getSwitchStatus() const;
+
+        // changes whenever the fidelity of any host may have changed, see common/DirectRoles.h
+        long getFidelityGeneration() const { return getInstance().fidelityGeneration; }
+
+        // fidelity of a single host, by module name
+        int getState(const char *node) const;
+        bool getSwitchStatus(const char *node) const;
+
+        // application tree derived from the NED topology
+        const string& getParent(const char *node) const;
+        const vector<string>& getChildren(const char *node) const;
+        cModule *findHost(const L3Address& address);
+
+        // plain control and direct-mode messages, recycled through the controller's pool
+        cMessage *acquireMessage(const char *name, short kind);
+        void releaseMessage(cMessage *msg);
+
+        // cached app[0]/appIn (and transport) endpoints of a host, for sendDirect()
+        const DirectPeer& getPeer(const string& host);
+
+        // instead of sendDirect() to a peer in another partition: the controller of that partition
+        // hands msg to the peer's app after delay, which must not be shorter than the lookahead
+        void sendToPartition(const DirectPeer& peer, cMessage *msg, simtime_t delay);
+
+        // layer 0: msg reaches the app of `to` once the flow from `from` has carried one message of
+        // their link, at a max-min fair share of the channels plus their propagation delay
+        void sendFlow(const char *from, const char *to, cMessage *msg);
+
+        // layer 1 with directBatching: children post their answers, and the parent collects the ones
+        // that arrived by now once per TIMER epoch instead of receiving each as an event
+        bool isBatched(const char *node) const;
+        void postDirect(const char *node, int source, simtime_t sent, simtime_t arrival);
+        vector<DirectRecord> collectDirect(const char *node);
+
+        // one-way delay of a direct message between node and its parent, or a random
+        // directly linked child; fallback unless delayModel is "calibrated"
+        simtime_t getParentDelay(const char *node, simtime_t fallback);
+        simtime_t getChildDelay(const char *node, simtime_t fallback);
+
+        // false if a direct message from node to its parent (up) or back is lost (directLoss);
+        // otherwise sets delay to the channel jitter (directJitter, else 0)
+        bool sampleTransfer(const char *node, bool up, simtime_t& delay);
+
+        // true if the link between node and its parent is abstracted, i.e. both ends are in the same active layer-0 or layer-1 window
+        bool isDirectLink(const char *node) const;
+
+        // true if some child of node still reaches it over packet-level UDP
+        bool hasPacketLevelChildren(const char *node) const;
+
         void setState();
+        void readSchedule();
+        bool usesLayer(int layer) const;
 
-        void sendToSources(cMessage *msg);
-        void sendToTargets(cMessage *msg);
+        void sendToSources(cMessage *msg, const FidelityWindow& window);
+        void sendToTargets(cMessage *msg, const FidelityWindow& window);
 
         void addUdpStats(simtime_t previousTime, simtime_t currentTime);
+        // round trip of a request sent by node to its parent, for the calibrated delay model
+        void addRoundTrip(const char *node, simtime_t sent, simtime_t arrival);
         void addDirectStats(simtime_t previousTime, simtime_t currentTime);
 
         void appendTotalPacketsLost(long packets);
         long getTotalPacketsLost() const;
 
-        int getNewLayer() const;
+        int getNewLayer(const char *node) const;
 
-        int getNumNodes() const;
-        int getNumReady() const;
+        // called once by each target after STOP_UDP, when it has no packet in flight;
+        // the last report commits the window (COMMIT_UDP to targets, INIT_TIMER to sources)
+        void reportDrained(const char *node);
+        bool isWindowReady(const char *node) const;
 
-        void incrementNumNodes();
-        void incrementNumReady();
+        // migrateInFlight: at STOP_UDP a target hands the replies it still waits for to the direct mode
+        // instead of draining them; false if the reply is lost (directLoss), else arrival is when it
+        // comes back as a MIGRATED_REPLY, one direct round trip after its request was sent
+        bool migratesInFlight() const { return getInstance().migrateInFlight; }
+        bool getMigratedArrival(const char *node, simtime_t sent, simtime_t fallback, simtime_t& arrival);
 
         virtual void finish() override;
 };
 
+// transport of the direct-mode roles in common/DirectRoles.h
+struct UdpDirectTransport {
+    typedef ExperimentControlUDP Control;
+    typedef ::msg_kind Kind;
+    static Control& control() { return ExperimentControlUDP::getInstance(); }
+    static bool transfer(const char *node, bool up, simtime_t& delay) {
+        return control().sampleTransfer(node, up, delay);
+    }
+};
+
 }
 
 #endif /* UDP_EXPERIMENTCONTROLUDP_H_ */
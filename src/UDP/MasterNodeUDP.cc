@@ -32,108 +32,33 @@ void MasterNodeUDP::initialize(int stage)
         // init statistics
         numEchoed = 0;
         WATCH(numEchoed);
+        data.configure(par("dataCapacity"), par("dataRetention"));
 
         directArrival = registerSignal("directMsgArrived");
-        realTime = registerSignal("recordWallTime");
-        pkLossCount = registerSignal("totalPacketsLost");
-
-        startClock = clock();
-
-        cMessage *wallTime = new cMessage("record_wall_time", msg_kind::RECORD_TIME);
-        scheduleAt(simTime(), wallTime);
-
     }
 }
 
 void MasterNodeUDP::handleMessageWhenUp(cMessage *msg)
 {
-    if (msg->getKind() == msg_kind::RECORD_TIME) {
-        emit(realTime, (clock() - startClock) / (double) CLOCKS_PER_SEC);
-        emit(pkLossCount, ExperimentControlUDP::getInstance().getTotalPacketsLost());
-        scheduleAt(simTime() + 1, msg);
+    // fusion nodes outside the region still send packets to the master
+    if (handleParentMessage(msg))
         return;
-    }
-
-    if (ExperimentControlUDP::getInstance().getSwitchStatus()) {
-        if (ExperimentControlUDP::getInstance().getState() == 1 && ExperimentControlUDP::getInstance().getNumNodes() == ExperimentControlUDP::getInstance().getNumReady()) {
-            if (msg->getKind() == msg_kind::TIMER || msg->getKind() == msg_kind::INIT_TIMER) {
-                // Set time
-                lastDirectMsgTime = simTime();
-
-                // Schedule next TIMER call
-                cMessage* tmMsg = new cMessage(nullptr, msg_kind::TIMER);
-                scheduleAt(simTime() + frequency, tmMsg);
 
-                // Schedule message to be finally sent after propagation delay
-                EV_INFO << "delayedMsgSend " << getParentModule()->getName() << " " << simTime();
-                delayedMsgSend(msg, ExperimentControlUDP::getInstance().getState());
-            } else if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-                EV_INFO << "finalMsgSend " << getParentModule()->getName() << " " << simTime();
-                for (std::string s : targets) {
-                    std::string targetPath("UDPnetworksim." + s + ".app[0]");
-                    finalMsgSend(msg, targetPath.c_str(), ExperimentControlUDP::getInstance().getState());
-                }
-                delete msg;
-            } else if (msg->getKind() == msg_kind::APP_MSG_RETURNED) {
-                saveData(msg);
-                emit(directArrival, SIMTIME_DBL(simTime()) - SIMTIME_DBL(lastDirectMsgTime));
-                ExperimentControlUDP::getInstance().addDirectStats(lastDirectMsgTime, simTime());
-            } else {
-                delete msg;
-            }
-        } else {
-            socket.processMessage(msg);
-        }
-    } else if (msg->isSelfMessage() && msg->getKind() == msg_kind::TIMER) {
-        delete msg;
-    } else if (msg->getKind() == msg_kind_transport::DIRECT_TO_APP) {
+    if (msg->getKind() == msg_kind_transport::DIRECT_TO_APP) {
         saveData(msg);
     } else {
         socket.processMessage(msg);
     }
 }
 
-void MasterNodeUDP::saveData(cMessage* msg) {
-    data.push_back("data");
-    delete msg;
-}
-
-void MasterNodeUDP::delayedMsgSend(cMessage* msg, int layer) {
-    switch (layer) {
-        case 1:
-            if ((msg->isSelfMessage() && msg->getKind() == msg_kind::TIMER) || msg->getKind() == msg_kind::INIT_TIMER) {
-                delete msg;
-                msg = new cMessage(nullptr, msg_kind::APP_SELF_MSG);
-                scheduleAt(simTime() + propagationDelay, msg);
-            } else {
-                error("Must be a self message with kind TIMER or message with kind INIT_TIMER");
-            }
-            break;
-        case 2:
-            break;
-        default:
-            error("Invalid route");
-            break;
-    }
+bool MasterNodeUDP::isParentReady() const {
+    // direct traffic starts once the drain of the window is committed
+    return ExperimentControlUDP::getInstance().isWindowReady(getParentModule()->getFullName());
 }
 
-void MasterNodeUDP::finalMsgSend(cMessage* msg, const char* mod, int layer) {
-    switch (layer) {
-        case 1:
-            if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-                cMessage *tmp = new cMessage(nullptr, msg_kind::APP_MSG_SENT);
-                cModule *targetModule = getModuleByPath(mod);
-                sendDirect(tmp, targetModule, "appIn");
-            } else {
-                error("Must be a self message with kind APP_SELF_MSG");
-            }
-            break;
-        case 2:
-            break;
-        default:
-            error("Invalid route");
-            break;
-    }
+void MasterNodeUDP::saveData(cMessage* msg) {
+    data.store(msg->getSenderModuleId(), simTime(), SIMTIME_DBL(simTime() - msg->getSendingTime()));
+    ExperimentControlUDP::getInstance().releaseMessage(msg);
 }
 
 void MasterNodeUDP::socketDataArrived(UdpSocket *socket, Packet *pk)
@@ -174,6 +99,9 @@ void MasterNodeUDP::refreshDisplay() const
 
 void MasterNodeUDP::finish()
 {
+    long numHeld;
+    double age = data.fuse(SIMTIME_ZERO, &numHeld);
+    EV_INFO << getFullPath() << ": holds " << numHeld << " of " << data.getNumReceived() << " readings received, mean age " << age << "s\n";
     ApplicationBase::finish();
 }
 
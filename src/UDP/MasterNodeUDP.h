@@ -17,6 +17,7 @@
 #define UDP_MASTERNODEUDP_H_
 
 #include "ExperimentControlUDP.h"
+#include "common/DirectRoles.h"
 #include "inet/common/INETDefs.h"
 
 #include "inet/applications/base/ApplicationBase.h"
@@ -24,34 +25,28 @@
 
 #include <vector>
 #include <string>
-#include <ctime>
 
 using std::vector;
 using std::string;
 
 namespace inet {
 
-class MasterNodeUDP : public ApplicationBase, public UdpSocket::ICallback {
+class MasterNodeUDP : public ApplicationBase, public UdpSocket::ICallback, public DirectParentRole<MasterNodeUDP, UdpDirectTransport> {
+
+    friend class DirectParentRole<MasterNodeUDP, UdpDirectTransport>;
 
     private:
         simsignal_t directArrival;
-        simsignal_t realTime;
-        simsignal_t pkLossCount;
-
-        clock_t startClock;
 
     protected:
         UdpSocket socket;
         int numEchoed;    // just for WATCH
 
-        vector<string> data;
-        const vector<string> targets = {"DF1", "DF2"};
+        SensorStore data; // readings received in direct mode
 
         const_simtime_t propagationDelay = 0.01;
         const_simtime_t frequency = 2;
 
-        simtime_t lastDirectMsgTime = 0;
-
     protected:
         virtual int numInitStages() const override { return NUM_INIT_STAGES; }
         virtual void initialize(int stage) override;
@@ -68,9 +63,7 @@ class MasterNodeUDP : public ApplicationBase, public UdpSocket::ICallback {
         virtual void socketClosed(UdpSocket *socket) override;
 
         void saveData(cMessage* msg);
-
-        virtual void delayedMsgSend(cMessage* msg, int layer);
-        virtual void finalMsgSend(cMessage* msg, const char* mod, int layer);
+        bool isParentReady() const;
 };
 
 }
@@ -57,7 +57,6 @@ void SensorNodeUDP::initialize(int stage)
 
         udpArrival = registerSignal("udpPkArrived");
 
-        ExperimentControlUDP::getInstance().incrementNumNodes();
     }
 }
 
@@ -110,11 +109,12 @@ L3Address SensorNodeUDP::chooseDestAddr()
 
 void SensorNodeUDP::sendPacket()
 {
-    if (ExperimentControlUDP::getInstance().getSwitchStatus() && ExperimentControlUDP::getInstance().getState() == 1 && ExperimentControlUDP::getInstance().getNumNodes() == ExperimentControlUDP::getInstance().getNumReady()) {
+    if (drainPending) {
         return;
     }
 
     udpMsgTimes.push(simTime());
+    requestSent();
 
     std::ostringstream str;
     str << packetName << "-" << numSent;
@@ -185,41 +185,38 @@ void SensorNodeUDP::processStop()
 
 void SensorNodeUDP::handleMessageWhenUp(cMessage *msg)
 {
-    if (msg->getKind() == msg_kind::APP_MSG_SENT) {
-        delete msg;
-        msg = new cMessage(nullptr, msg_kind::APP_SELF_MSG);
-        scheduleAt(simTime() + propagationDelay, msg);
-    } else if (msg->getKind() == msg_kind::APP_SELF_MSG) {
-        msg->setKind(msg_kind::APP_MSG_RETURNED);
-        cModule* targetModule = getModuleByPath(getDirectDestination(getParentModule()->getName()));
-        sendDirect(msg, targetModule, "appIn");
+    if (handleChildMessage(msg)) {
+        return;
     } else if (msg->getKind() == msg_kind::STOP_UDP) {
-//         check if udpMsgTimes is empty, packet consistency
-         if (udpMsgTimes.empty() && !ready) {
-             ExperimentControlUDP::getInstance().incrementNumReady();
-             ready = true;
-         }
-
-         if (ExperimentControlUDP::getInstance().getNumNodes() == ExperimentControlUDP::getInstance().getNumReady()) {
-             socket.destroy();
-             if (selfMsg->isSelfMessage()) {
-                 cancelEvent(selfMsg);
-             }
-
-             delete msg;
-         } else {
-             scheduleAt(simTime() + 0.01, msg);
-         }
-
+        // the last reply completes the drain in processPacket()
+        drainPending = true;
+        if (ExperimentControlUDP::getInstance().migratesInFlight()) {
+            migrateInFlight();
+            udpMsgTimes = queue<simtime_t>();
+        }
+        checkDrained();
+        ExperimentControlUDP::getInstance().releaseMessage(msg);
+    } else if (msg->getKind() == msg_kind::COMMIT_UDP) {
+        socket.destroy();
+        if (selfMsg->isSelfMessage()) {
+            cancelEvent(selfMsg);
+        }
+        // replies still outstanding after the drain deadline are considered lost
+        udpMsgTimes = queue<simtime_t>();
+        clearInFlight();
+        ExperimentControlUDP::getInstance().releaseMessage(msg);
     } else if (msg->getKind() == msg_kind::RESTART_UDP) {
         ready = false;
-        selfMsg = new cMessage("restart", START);
+        drainPending = false;
+        cancelEvent(selfMsg);
+        selfMsg->setKind(START);
         scheduleAt(simTime(), selfMsg);
-        delete msg;
+        ExperimentControlUDP::getInstance().releaseMessage(msg);
     } else if (msg->isSelfMessage()) { // sending
         // TODO send as direct rather than deleting
-        if (ExperimentControlUDP::getInstance().getSwitchStatus() && ExperimentControlUDP::getInstance().getNewLayer() == 1) {
-            delete msg;
+        const char *name = getParentModule()->getFullName();
+        if (ExperimentControlUDP::getInstance().isDirectLink(name) && isApplicationLevel(ExperimentControlUDP::getInstance().getState(name))) {
+            // selfMsg stays unscheduled until RESTART_UDP
             return;
         }
 
@@ -247,15 +244,6 @@ void SensorNodeUDP::handleMessageWhenUp(cMessage *msg)
     }
 }
 
-const char* SensorNodeUDP::getDirectDestination(const char* currentMod) const {
-    if (strcmp(currentMod, "SN1") == 0 || strcmp(currentMod, "SN2") == 0) {
-        return "UDPnetworksim.DF1.app[0]";
-    } else if (strcmp(currentMod, "SN3") == 0 || strcmp(currentMod, "SN4") == 0) {
-        return "UDPnetworksim.DF2.app[0]";
-    }
-    return "";
-}
-
 void SensorNodeUDP::socketDataArrived(UdpSocket *socket, Packet *packet)
 {
     // process incoming packet
@@ -283,12 +271,21 @@ void SensorNodeUDP::refreshDisplay()
     getDisplayString().setTagArg("t", 0, buf);
 }
 
+void SensorNodeUDP::checkDrained()
+{
+    if (drainPending && !ready && udpMsgTimes.empty()) {
+        ready = true;
+        ExperimentControlUDP::getInstance().reportDrained(getParentModule()->getFullName());
+    }
+}
+
 void SensorNodeUDP::processPacket(Packet *pk)
 {
     emit(packetReceivedSignal, pk);
     EV_INFO << "Received packet: " << UdpSocket::getReceivedPacketInfo(pk) << endl;
     delete pk;
     numReceived++;
+    replyArrived();
 
     ExperimentControlUDP::getInstance().appendTotalPacketsLost((long)(numSent-numReceived) - packetsLost);
     if (packetsLost < numSent-numReceived) {
@@ -307,6 +304,7 @@ void SensorNodeUDP::processPacket(Packet *pk)
         }
         udpMsgTimes.pop();
     }
+    checkDrained();
 }
 
 void SensorNodeUDP::handleStartOperation(LifecycleOperation *operation)
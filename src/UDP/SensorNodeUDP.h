@@ -25,6 +25,7 @@ using std::string;
 using std::queue;
 
 #include "ExperimentControlUDP.h"
+#include "common/DirectRoles.h"
 #include "inet/common/INETDefs.h"
 
 #include "inet/applications/base/ApplicationBase.h"
@@ -32,11 +33,15 @@ using std::queue;
 
 namespace inet {
 
-class SensorNodeUDP : public ApplicationBase, public UdpSocket::ICallback {
+class SensorNodeUDP : public ApplicationBase, public UdpSocket::ICallback,
+                      public DirectChildRole<SensorNodeUDP, UdpDirectTransport> {
+
+    friend class DirectChildRole<SensorNodeUDP, UdpDirectTransport>;
 
     private:
         simsignal_t udpArrival;
-        bool ready = false;
+        bool ready = false; // drain reported to the controller
+        bool drainPending = false; // STOP_UDP received, no new packets until RESTART_UDP
 
     protected:
         enum SelfMsgKinds { START = 1, SEND, STOP };
@@ -73,6 +78,7 @@ class SensorNodeUDP : public ApplicationBase, public UdpSocket::ICallback {
         virtual L3Address chooseDestAddr();
         virtual void sendPacket();
         virtual void processPacket(Packet *msg);
+        void checkDrained();
         virtual void setSocketOptions();
 
         virtual void processStart();
@@ -87,7 +93,6 @@ class SensorNodeUDP : public ApplicationBase, public UdpSocket::ICallback {
         virtual void socketErrorArrived(UdpSocket *socket, Indication *indication) override;
         virtual void socketClosed(UdpSocket *socket) override;
 
-        const char* getDirectDestination(const char* currentMod) const;
 
     public:
         SensorNodeUDP();
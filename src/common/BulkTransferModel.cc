@@ -0,0 +1,100 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "BulkTransferModel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace inet {
+
+static const int64_t ACK_BITS = 8 * 40; // TCP and IPv4 headers without options
+
+void BulkTransferModel::build(cModule *network, const RoutingGraph& graph) {
+    links.clear();
+    for (const auto& link : graph.getParents()) {
+        if (!graph.hasRoute(link.first))
+            continue; // child in another partition
+        cModule *host = network->getModuleByPath(("." + link.first).c_str());
+        cModule *parent = network->getModuleByPath(("." + link.second).c_str());
+        const DirectRoute& route = graph.getRoute(link.first);
+        Link& model = links[link.first];
+        model.up = makeDirection(route.up, route.down, host->getSubmodule("tcp"), parent->getSubmodule("tcp"));
+        model.down = makeDirection(route.down, route.up, parent->getSubmodule("tcp"), host->getSubmodule("tcp"));
+    }
+}
+
+BulkTransferModel::Direction BulkTransferModel::makeDirection(const vector<cDatarateChannel*>& forward, const vector<cDatarateChannel*>& backward, cModule *sender, cModule *receiver) {
+    Direction direction;
+    if (sender && sender->hasPar("mss"))
+        direction.mss = sender->par("mss").intValue();
+    direction.initialWindow = direction.mss;
+    if (sender && sender->hasPar("increasedIWEnabled") && sender->par("increasedIWEnabled").boolValue())
+        direction.initialWindow = std::min<int64_t>(4 * direction.mss, std::max<int64_t>(2 * direction.mss, 4380)); // RFC 3390
+    if (receiver && receiver->hasPar("advertisedWindow"))
+        direction.receiveWindow = receiver->par("advertisedWindow").intValue();
+
+    double delivered = 1;
+    for (cDatarateChannel *channel : forward) {
+        if (!channel)
+            continue;
+        double datarate = channel->getDatarate();
+        double transmission = datarate > 0 ? 8 * direction.mss / datarate : 0;
+        direction.oneWayDelay += channel->getDelay().dbl() + transmission;
+        if (datarate > 0 && (direction.bottleneck == 0 || datarate < direction.bottleneck))
+            direction.bottleneck = datarate;
+        delivered *= 1 - channel->getPacketErrorRate();
+    }
+    direction.per = 1 - delivered;
+    direction.rtt = direction.oneWayDelay;
+    for (cDatarateChannel *channel : backward) {
+        if (channel)
+            direction.rtt += channel->getDelay().dbl() + (channel->getDatarate() > 0 ? ACK_BITS / channel->getDatarate() : 0);
+    }
+    return direction;
+}
+
+simtime_t BulkTransferModel::getCompletionTime(const string& host, bool up, int64_t bytes) const {
+    auto it = links.find(host);
+    if (it == links.end())
+        throw cRuntimeError("Host %s has no bulk transfer model", host.c_str());
+    const Direction& d = up ? it->second.up : it->second.down;
+    if (bytes <= 0)
+        return SIMTIME_ZERO;
+
+    // steady sending rate in bit/s
+    double rtt = std::max(d.rtt, 1e-9);
+    double rate = d.bottleneck > 0 ? d.bottleneck : INFINITY;
+    if (d.receiveWindow > 0)
+        rate = std::min(rate, 8 * d.receiveWindow / rtt);
+    if (d.per > 0)
+        rate = std::min(rate, 8 * d.mss / rtt * std::sqrt(1.5 / d.per));
+
+    // slow start: the window doubles every RTT until it carries the steady rate
+    double window = d.initialWindow;
+    double steadyWindow = rate * rtt / 8;
+    double sent = 0;
+    double elapsed = 0;
+    while (window < steadyWindow && sent + window < bytes) {
+        sent += window;
+        elapsed += rtt;
+        window *= 2;
+    }
+    if (std::isinf(rate))
+        return elapsed + d.oneWayDelay;
+    return elapsed + 8 * (bytes - sent) / rate + d.oneWayDelay;
+}
+
+}
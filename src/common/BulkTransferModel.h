@@ -0,0 +1,72 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef COMMON_BULKTRANSFERMODEL_H_
+#define COMMON_BULKTRANSFERMODEL_H_
+
+#include <map>
+#include <string>
+#include <omnetpp.h>
+
+#include "RoutingGraph.h"
+
+using namespace omnetpp;
+using std::string;
+
+namespace inet {
+
+/**
+ * Completion time of a TCP bulk transfer over an application link, so that
+ * a large reply can be delivered as one event instead of hundreds of
+ * segments and ACKs.
+ *
+ * The steady rate is the smallest of the bottleneck datarate, the receive
+ * window per RTT and the Mathis et al. loss limit MSS/RTT * sqrt(3/(2p)),
+ * with p the route's packet error rate. Slow start doubles the window from
+ * the initial window every RTT until it reaches that rate. RTT and one-way
+ * delay are the channels' delays plus the transmission of one segment (and
+ * of its ACK on the way back). MSS, initial window and receive window are
+ * read once from the hosts' tcp modules.
+ */
+class BulkTransferModel {
+
+    private:
+        struct Direction {
+            double rtt = 0;
+            double oneWayDelay = 0;
+            double bottleneck = 0; // bit/s
+            double per = 0;
+            int64_t mss = 536;
+            int64_t initialWindow = 536;
+            int64_t receiveWindow = 0; // 0: unlimited
+        };
+        struct Link {
+            Direction up; // data from the host to its parent
+            Direction down; // data from the parent to the host
+        };
+        std::map<string, Link> links;
+
+        static Direction makeDirection(const vector<cDatarateChannel*>& forward, const vector<cDatarateChannel*>& backward, cModule *sender, cModule *receiver);
+
+    public:
+        void build(cModule *network, const RoutingGraph& graph);
+
+        // from handing `bytes` to the sending TCP until the last byte reaches the receiver
+        simtime_t getCompletionTime(const string& host, bool up, int64_t bytes) const;
+};
+
+}
+
+#endif /* COMMON_BULKTRANSFERMODEL_H_ */
@@ -0,0 +1,185 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#include "ColumnarRecorder.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "omnetpp/cconfigoption.h"
+#include "InstrumentedScheduler.h"
+
+namespace inet {
+
+Register_ResultRecorder("columnar", ColumnarRecorder);
+
+Register_PerRunConfigOption(CFGID_COLUMNAR_OUTPUT, "columnar-output", CFG_FILENAME, "${resultdir}/${configname}-${runnumber}.col", "File written by the \"columnar\" result recorder.");
+Register_PerRunConfigOption(CFGID_COLUMNAR_BLOCK_SIZE, "columnar-block-size", CFG_INT, "4096", "Samples buffered by each \"columnar\" recorder before they are written out as a block.");
+
+static const size_t SPILL_SIZE = 1 << 20;
+
+void ColumnarWriter::attach() {
+    if (numUsers++ > 0)
+        return;
+    path = getEnvir()->getConfig()->getAsFilename(CFGID_COLUMNAR_OUTPUT);
+    numVectors = 0;
+    buffer.clear();
+    buffer.append("CPSCOL1\n");
+    buffer.push_back((char) SimTime::getScaleExp());
+}
+
+void ColumnarWriter::detach() {
+    if (--numUsers > 0)
+        return;
+    spill(true);
+    out.close();
+}
+
+void ColumnarWriter::putVarint(uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back((char) value);
+}
+
+void ColumnarWriter::putString(const string& text) {
+    uint16_t length = (uint16_t) std::min(text.size(), (size_t) UINT16_MAX);
+    putRaw(&length, sizeof(length));
+    putRaw(text.data(), length);
+}
+
+void ColumnarWriter::spill(bool force) {
+    if (buffer.size() < SPILL_SIZE && !force)
+        return;
+    // opened on first use, so that runs forked before it write files of their own
+    if (!out.is_open()) {
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw cRuntimeError("Cannot open columnar output \"%s\"", path.c_str());
+    }
+    out.write(buffer.data(), buffer.size());
+    out.flush();
+    buffer.clear();
+}
+
+void ColumnarWriter::flush() {
+    if (out.is_open())
+        spill(true);
+}
+
+uint32_t ColumnarWriter::declare(const string& module, const string& name) {
+    uint32_t id = numVectors++;
+    buffer.push_back('V');
+    putRaw(&id, sizeof(id));
+    putString(module);
+    putString(name);
+    return id;
+}
+
+void ColumnarWriter::writeBlock(uint32_t id, const vector<int64_t>& times, const vector<int8_t>& layers, const vector<double>& values) {
+    uint32_t rows = times.size();
+    buffer.push_back('B');
+    putRaw(&id, sizeof(id));
+    putRaw(&rows, sizeof(rows));
+
+    int64_t previousTime = 0;
+    for (int64_t time : times) {
+        putVarint(time - previousTime);
+        previousTime = time;
+    }
+
+    // the layer changes only with the windows
+    for (size_t i = 0; i < rows;) {
+        size_t j = i;
+        while (j < rows && layers[j] == layers[i])
+            j++;
+        putVarint(j - i);
+        putZigzag(layers[i]);
+        i = j;
+    }
+
+    // byte counts, sequence numbers and the like are integers
+    bool integral = std::all_of(values.begin(), values.end(), [](double value) {
+        return std::fabs(value) < 1e15 && value == std::floor(value);
+    });
+    buffer.push_back(integral ? 1 : 0);
+    if (integral) {
+        int64_t previousValue = 0;
+        for (double value : values) {
+            putZigzag((int64_t) value - previousValue);
+            previousValue = (int64_t) value;
+        }
+    } else {
+        putRaw(values.data(), rows * sizeof(double));
+    }
+    spill(false);
+}
+
+ColumnarRecorder::~ColumnarRecorder() {
+    // a run that stopped with an error keeps what was collected, if it can be written
+    try {
+        detach();
+    } catch (std::exception&) {
+    }
+}
+
+void ColumnarRecorder::collect(simtime_t_cref t, double value, cObject *details) {
+    if (!attached) {
+        ColumnarWriter::getInstance().attach();
+        attached = true;
+        // a channel's samples take the layer of the module it is in
+        cComponent *component = getComponent();
+        module = component->isModule() ? static_cast<cModule *>(component) : component->getParentModule();
+        blockSize = std::max((int64_t) 1, (int64_t) getEnvir()->getConfig()->getAsInt(CFGID_COLUMNAR_BLOCK_SIZE));
+        times.reserve(blockSize);
+        layers.reserve(blockSize);
+        values.reserve(blockSize);
+    }
+    times.push_back(t.raw());
+    layers.push_back((int8_t) InstrumentedScheduler::getFidelity(module));
+    values.push_back(value);
+    if (times.size() >= blockSize)
+        flush();
+}
+
+void ColumnarRecorder::flush() {
+    if (times.empty())
+        return;
+    ColumnarWriter& writer = ColumnarWriter::getInstance();
+    if (!declared) {
+        id = writer.declare(getComponent()->getFullPath(), getResultName());
+        declared = true;
+    }
+    writer.writeBlock(id, times, layers, values);
+    times.clear();
+    layers.clear();
+    values.clear();
+}
+
+void ColumnarRecorder::detach() {
+    if (!attached)
+        return;
+    attached = false;
+    flush();
+    ColumnarWriter::getInstance().detach();
+}
+
+void ColumnarRecorder::finish(cResultFilter *prev) {
+    detach();
+}
+
+}
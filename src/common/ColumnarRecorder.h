@@ -0,0 +1,110 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef COMMON_COLUMNARRECORDER_H_
+#define COMMON_COLUMNARRECORDER_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+namespace inet {
+
+/**
+ * The binary file shared by all columnar recorders of a run.
+ *
+ * The file starts with the magic "CPSCOL1\n" and the simtime scale exponent
+ * (int8), followed by records. 'V' declares a vector: id (uint32), module
+ * path, result name (each uint16 length + bytes). 'B' is a block of rows of
+ * one vector: id, row count (uint32), then the columns one after the other:
+ *
+ *  - time: raw simtime of the first row, then the increments, as varints
+ *  - fidelity: runs of (length varint, layer zigzag varint)
+ *  - value: encoding byte; 1: first value, then the increments, as zigzag
+ *    varints (all values integral); 0: little-endian doubles
+ *
+ * simulations/columnar.py reads it back.
+ */
+class ColumnarWriter {
+
+    private:
+        std::ofstream out;
+        string path;
+        string buffer; // written out in large chunks
+        uint32_t numVectors = 0;
+        int numUsers = 0;
+
+        void putVarint(uint64_t value);
+        void putZigzag(int64_t value) { putVarint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63)); }
+        void putString(const string& text);
+        void putRaw(const void *data, size_t size) { buffer.append(static_cast<const char *>(data), size); }
+        void spill(bool force);
+
+    public:
+        static ColumnarWriter& getInstance() {
+            static ColumnarWriter instance;
+            return instance;
+        }
+
+        // the file is opened by the first of the recorders of a run and closed by the last
+        void attach();
+        void detach();
+
+        // writes out what is buffered, if the file is open already (before a fork)
+        void flush();
+
+        uint32_t declare(const string& module, const string& name);
+        void writeBlock(uint32_t id, const vector<int64_t>& times, const vector<int8_t>& layers, const vector<double>& values);
+};
+
+/**
+ * Result recorder "columnar": like "vector", but buffered and written to the
+ * binary file of ColumnarWriter, with the layer of the fidelity window the
+ * recording host was in next to every sample. Selected per statistic, e.g.
+ * **.directTimes.result-recording-modes = -vector,+columnar
+ */
+class ColumnarRecorder : public cNumericResultRecorder {
+
+    private:
+        uint32_t id = 0;
+        bool declared = false;
+        bool attached = false;
+        cModule *module = nullptr; // whose host's layer tags the samples
+        size_t blockSize = 0;
+        vector<int64_t> times;
+        vector<int8_t> layers;
+        vector<double> values;
+
+        void flush();
+        void detach();
+
+    protected:
+        virtual void collect(simtime_t_cref t, double value, cObject *details) override;
+        virtual void finish(cResultFilter *prev) override;
+
+    public:
+        virtual ~ColumnarRecorder();
+};
+
+}
+
+#endif /* COMMON_COLUMNARRECORDER_H_ */
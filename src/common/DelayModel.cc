@@ -0,0 +1,58 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "DelayModel.h"
+
+namespace inet {
+
+std::pair<string, string> DelayModel::key(const string& a, const string& b) {
+    return a < b ? std::make_pair(a, b) : std::make_pair(b, a);
+}
+
+void DelayModel::configure(size_t capacity, long minSamples) {
+    if (capacity == 0)
+        throw cRuntimeError("Delay reservoirs need room for at least one sample");
+    this->capacity = capacity;
+    this->minSamples = minSamples;
+    links.clear();
+}
+
+void DelayModel::collect(const string& from, const string& to, double roundTrip, cRNG *rng) {
+    Reservoir& reservoir = links[key(from, to)];
+    reservoir.seen++;
+    if (reservoir.samples.size() < capacity) {
+        reservoir.samples.push_back(roundTrip);
+    } else {
+        // keep each of the samples seen so far with equal probability
+        long slot = intuniform(rng, 0, reservoir.seen - 1);
+        if (slot < (long)capacity)
+            reservoir.samples[slot] = roundTrip;
+    }
+}
+
+simtime_t DelayModel::sample(const string& from, const string& to, simtime_t fallback, cRNG *rng) const {
+    auto it = links.find(key(from, to));
+    if (it == links.end() || it->second.seen < minSamples)
+        return fallback;
+    const vector<double>& samples = it->second.samples;
+    return samples[intuniform(rng, 0, samples.size() - 1)] / 2;
+}
+
+long DelayModel::getNumSamples(const string& from, const string& to) const {
+    auto it = links.find(key(from, to));
+    return it != links.end() ? it->second.seen : 0;
+}
+
+}
@@ -0,0 +1,69 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef COMMON_DELAYMODEL_H_
+#define COMMON_DELAYMODEL_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+namespace inet {
+
+/**
+ * One-way delays of the application links, learned from the round trips
+ * measured while the links are simulated at packet level. Direct mode samples
+ * them instead of a constant propagation delay.
+ *
+ * Each link keeps a uniform reservoir of at most `capacity` round trips, so
+ * the distribution covers the whole run at bounded memory. A link is
+ * undirected: the round trip measured by a sensor towards its data fusion
+ * node also calibrates the data fusion node's requests to that sensor.
+ */
+class DelayModel {
+
+    private:
+        struct Reservoir {
+            vector<double> samples;
+            long seen = 0;
+        };
+        std::map<std::pair<string, string>, Reservoir> links;
+        size_t capacity = 1000;
+        long minSamples = 10;
+
+        static std::pair<string, string> key(const string& a, const string& b);
+
+    public:
+        void configure(size_t capacity, long minSamples);
+        void clear() { links.clear(); }
+
+        // round trip of a request from `from` answered by `to`
+        void collect(const string& from, const string& to, double roundTrip, cRNG *rng);
+
+        // half of a sampled round trip, or fallback while fewer than minSamples were seen
+        simtime_t sample(const string& from, const string& to, simtime_t fallback, cRNG *rng) const;
+
+        long getNumSamples(const string& from, const string& to) const;
+};
+
+}
+
+#endif /* COMMON_DELAYMODEL_H_ */
@@ -0,0 +1,56 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#include <algorithm>
+#include "DirectBatch.h"
+
+namespace inet {
+
+void DirectBatch::clear() {
+    pending.clear();
+    numPosted = numBatches = 0;
+}
+
+void DirectBatch::post(const string& destination, int source, simtime_t sent, simtime_t arrival) {
+    pending[destination].push_back({sent, arrival, source});
+    numPosted++;
+}
+
+vector<DirectRecord> DirectBatch::collect(const string& destination, simtime_t now) {
+    vector<DirectRecord> arrived;
+    auto it = pending.find(destination);
+    if (it == pending.end())
+        return arrived;
+    vector<DirectRecord> waiting;
+    for (const DirectRecord& record : it->second)
+        (record.arrival <= now ? arrived : waiting).push_back(record);
+    it->second.swap(waiting);
+    // posted in send order, which is not arrival order once delays differ
+    std::stable_sort(arrived.begin(), arrived.end(),
+            [](const DirectRecord& a, const DirectRecord& b) { return a.arrival < b.arrival; });
+    if (!arrived.empty())
+        numBatches++;
+    return arrived;
+}
+
+long DirectBatch::getNumPending() const {
+    long n = 0;
+    for (const auto& it : pending)
+        n += it.second.size();
+    return n;
+}
+
+}
@@ -0,0 +1,71 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef COMMON_DIRECTBATCH_H_
+#define COMMON_DIRECTBATCH_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+namespace inet {
+
+/**
+ * One direct message waiting in a batch: sent by the parent at `sent`,
+ * answered by the child (module id `source`) and due back at the parent at
+ * `arrival`.
+ */
+struct DirectRecord {
+    simtime_t sent;
+    simtime_t arrival;
+    int source;
+};
+
+/**
+ * Answers of direct-mode children, gathered per destination module. Instead
+ * of one event per answer, a parent collects everything that has arrived at
+ * the start of its next TIMER epoch, so the events of a window grow with the
+ * number of nodes rather than the number of messages. The records keep their
+ * own arrival times, so the statistics are the same as if each answer had
+ * been delivered on its own.
+ */
+class DirectBatch {
+
+    private:
+        std::map<string, vector<DirectRecord>> pending;
+        long numPosted = 0;
+        long numBatches = 0;
+
+    public:
+        void clear();
+        void post(const string& destination, int source, simtime_t sent, simtime_t arrival);
+
+        // removes and returns the records for destination that arrived by now, in arrival order
+        vector<DirectRecord> collect(const string& destination, simtime_t now);
+
+        long getNumPosted() const { return numPosted; }
+        long getNumBatches() const { return numBatches; }
+        long getNumPending() const;
+};
+
+}
+
+#endif /* COMMON_DIRECTBATCH_H_ */
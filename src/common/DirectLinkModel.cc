@@ -0,0 +1,81 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "DirectLinkModel.h"
+
+#include <algorithm>
+
+namespace inet {
+
+void DirectLinkModel::build(cModule *network, const RoutingGraph& graph) {
+    links.clear();
+    for (const auto& link : graph.getParents()) {
+        if (!graph.hasRoute(link.first))
+            continue; // child in another partition
+        cModule *host = network->getModuleByPath(("." + link.first).c_str());
+        cModule *app = host->getSubmodule("app", 0);
+        cModule *tcp = host->getSubmodule("tcp");
+        int64_t segmentBytes = tcp && tcp->hasPar("mss") ? tcp->par("mss").intValue() : 0;
+        int64_t upBytes = app->par(app->hasPar("requestLength") ? "requestLength" : "messageLength").intValue();
+        int64_t downBytes = app->par(app->hasPar("replyLength") ? "replyLength" : "messageLength").intValue();
+
+        const DirectRoute& route = graph.getRoute(link.first);
+        Link& model = links[link.first];
+        model.up = makeDirection(route.up, upBytes, segmentBytes);
+        model.down = makeDirection(route.down, downBytes, segmentBytes);
+    }
+}
+
+DirectLinkModel::Direction DirectLinkModel::makeDirection(const vector<cDatarateChannel*>& channels, int64_t bytes, int64_t segmentBytes) {
+    Direction direction;
+    direction.bytes = bytes;
+    direction.numPackets = segmentBytes > 0 ? std::max<int64_t>(1, (bytes + segmentBytes - 1) / segmentBytes) : 1;
+    direction.packetBits = 8 * (segmentBytes > 0 ? std::min(bytes, segmentBytes) : bytes);
+    double delivered = 1;
+    for (cDatarateChannel *channel : channels) {
+        if (!channel)
+            continue;
+        delivered *= 1 - channel->getPacketErrorRate();
+        direction.datarates.push_back(channel->getDatarate());
+    }
+    direction.per = 1 - delivered;
+    return direction;
+}
+
+const DirectLinkModel::Direction& DirectLinkModel::get(const string& host, bool up) const {
+    auto it = links.find(host);
+    if (it == links.end())
+        throw cRuntimeError("Host %s has no direct link model", host.c_str());
+    return up ? it->second.up : it->second.down;
+}
+
+int DirectLinkModel::sampleLostPackets(const string& host, bool up, int numPackets, cRNG *rng) const {
+    double per = get(host, up).per;
+    if (per <= 0 || numPackets <= 0)
+        return 0;
+    return binomial(rng, numPackets, per);
+}
+
+simtime_t DirectLinkModel::sampleJitter(const string& host, bool up, cRNG *rng) const {
+    const Direction& direction = get(host, up);
+    double jitter = 0;
+    for (double datarate : direction.datarates) {
+        if (datarate > 0)
+            jitter += uniform(rng, 0, direction.packetBits / datarate);
+    }
+    return jitter;
+}
+
+}
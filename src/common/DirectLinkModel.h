@@ -0,0 +1,77 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef COMMON_DIRECTLINKMODEL_H_
+#define COMMON_DIRECTLINKMODEL_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <omnetpp.h>
+
+#include "RoutingGraph.h"
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+namespace inet {
+
+/**
+ * Loss and jitter of the application links in direct mode, taken from the
+ * `per` and `datarate` of the channels on each link's route.
+ *
+ * A message is cut into packets of the host's TCP mss (one packet if the
+ * host has none); each packet is lost with the route's packet error rate
+ * 1 - prod(1 - per). Jitter is a uniform wait of up to one packet's
+ * transmission time on every hop, as if queued behind another packet.
+ * Message lengths are read once from the child's app[0]: requestLength and
+ * replyLength for TCP, messageLength in both directions for UDP. They also
+ * size the transfers of the flow-level layer 0.
+ */
+class DirectLinkModel {
+
+    private:
+        struct Direction {
+            double per = 0; // packet error rate of the whole route
+            vector<double> datarates;
+            int64_t bytes = 0;
+            int numPackets = 1;
+            int64_t packetBits = 0;
+        };
+        struct Link {
+            Direction up; // from the host to its parent
+            Direction down; // from the parent to the host
+        };
+        std::map<string, Link> links;
+
+        static Direction makeDirection(const vector<cDatarateChannel*>& channels, int64_t bytes, int64_t segmentBytes);
+        const Direction& get(const string& host, bool up) const;
+
+    public:
+        void build(cModule *network, const RoutingGraph& graph);
+
+        double getLossProbability(const string& host, bool up) const { return get(host, up).per; }
+        int getNumPackets(const string& host, bool up) const { return get(host, up).numPackets; }
+        int64_t getMessageBytes(const string& host, bool up) const { return get(host, up).bytes; }
+
+        // how many of `numPackets` packets sent in one round between host and its parent are lost
+        int sampleLostPackets(const string& host, bool up, int numPackets, cRNG *rng) const;
+        simtime_t sampleJitter(const string& host, bool up, cRNG *rng) const;
+};
+
+}
+
+#endif /* COMMON_DIRECTLINKMODEL_H_ */
@@ -0,0 +1,85 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "DirectPeerRegistry.h"
+
+namespace inet {
+
+DirectPeerRegistry::~DirectPeerRegistry() {
+    if (network && network->isSubscribed(PRE_MODEL_CHANGE, this)) {
+        network->unsubscribe(PRE_MODEL_CHANGE, this);
+        network->unsubscribe(POST_MODEL_CHANGE, this);
+    }
+}
+
+void DirectPeerRegistry::reset(cModule *network, const char *transportName) {
+    if (this->network && this->network != network && this->network->isSubscribed(PRE_MODEL_CHANGE, this)) {
+        this->network->unsubscribe(PRE_MODEL_CHANGE, this);
+        this->network->unsubscribe(POST_MODEL_CHANGE, this);
+    }
+    peers.clear();
+    this->network = network;
+    this->transportName = transportName;
+    if (!network->isSubscribed(PRE_MODEL_CHANGE, this)) {
+        network->subscribe(PRE_MODEL_CHANGE, this);
+        network->subscribe(POST_MODEL_CHANGE, this);
+    }
+}
+
+const DirectPeer& DirectPeerRegistry::get(const string& host) {
+    auto it = peers.find(host);
+    if (it == peers.end())
+        it = peers.emplace(host, resolve(host)).first;
+    return it->second;
+}
+
+DirectPeer DirectPeerRegistry::resolve(const string& host) const {
+    if (!network)
+        throw cRuntimeError("DirectPeerRegistry used before reset()");
+    cModule *hostModule = network->getModuleByPath(("." + host).c_str());
+    if (!hostModule)
+        throw cRuntimeError("No host \"%s\" in network %s", host.c_str(), network->getFullPath().c_str());
+
+    DirectPeer peer;
+    peer.host = hostModule;
+    if (hostModule->isPlaceholder()) {
+        peer.remote = true; // reached through the controller of its partition
+        return peer;
+    }
+    peer.app = hostModule->getSubmodule("app", 0);
+    if (!peer.app)
+        throw cRuntimeError("Host \"%s\" has no app[0]", host.c_str());
+    peer.appInGateId = peer.app->findGate("appIn");
+    if (peer.appInGateId < 0)
+        throw cRuntimeError("%s has no appIn gate", peer.app->getFullPath().c_str());
+
+    peer.transport = hostModule->getSubmodule(transportName.c_str());
+    if (peer.transport)
+        peer.transportInGateId = peer.transport->findGate("transportIn");
+    return peer;
+}
+
+void DirectPeerRegistry::receiveSignal(cComponent *source, simsignal_t signalID, cObject *obj, cObject *details) {
+    // cached module pointers may dangle after a deletion, and new hosts must be picked up
+    if (cPreModuleDeleteNotification *notification = dynamic_cast<cPreModuleDeleteNotification *>(obj)) {
+        if (notification->module == network)
+            network = nullptr; // network teardown; the subscription goes away with it
+        invalidate();
+    } else if (dynamic_cast<cPostModuleAddNotification *>(obj)) {
+        invalidate();
+    }
+}
+
+}
@@ -0,0 +1,68 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef COMMON_DIRECTPEERREGISTRY_H_
+#define COMMON_DIRECTPEERREGISTRY_H_
+
+#include <map>
+#include <string>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::string;
+
+namespace inet {
+
+/**
+ * Resolved endpoints of one host for direct (sendDirect) delivery.
+ */
+struct DirectPeer {
+    cModule *host = nullptr;
+    bool remote = false; // in another partition of a parallel run; only host is set
+    cModule *app = nullptr; // app[0]
+    int appInGateId = -1;
+    cModule *transport = nullptr; // tcp or udp module, for transport-level bypass
+    int transportInGateId = -1;
+};
+
+/**
+ * Caches the direct-delivery endpoints of hosts by name, so that sends do not
+ * build module paths and call getModuleByPath() per message. The cache is
+ * dropped whenever a module is created or deleted in the network.
+ */
+class DirectPeerRegistry : public cListener {
+
+    private:
+        cModule *network = nullptr;
+        string transportName;
+        std::map<string, DirectPeer> peers;
+
+        DirectPeer resolve(const string& host) const;
+
+    public:
+        virtual ~DirectPeerRegistry();
+
+        // forgets all entries and starts watching the given network
+        void reset(cModule *network, const char *transportName);
+        void invalidate() { peers.clear(); }
+
+        const DirectPeer& get(const string& host);
+
+        virtual void receiveSignal(cComponent *source, simsignal_t signalID, cObject *obj, cObject *details) override;
+};
+
+}
+
+#endif /* COMMON_DIRECTPEERREGISTRY_H_ */
@@ -0,0 +1,352 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef COMMON_DIRECTROLES_H_
+#define COMMON_DIRECTROLES_H_
+
+#include <string>
+#include <omnetpp.h>
+
+#include "inet/common/Simsignals.h"
+#include "inet/common/packet/Packet.h"
+
+#include "DirectBatch.h"
+#include "DirectPeerRegistry.h"
+#include "SensorStore.h"
+
+using namespace omnetpp;
+using std::string;
+
+namespace inet {
+
+/**
+ * Direct-mode behaviour shared by the TCP and UDP applications, as CRTP
+ * bases of the node classes. A parent (MasterNode, DFNode) sends requests to
+ * its children every TIMER epoch; a child (SensorNode, DFNode) answers them.
+ *
+ * Transport supplies the controller and how a message crosses a link:
+ *
+ *   typedef <controller> Control;  typedef <message kind enum> Kind;
+ *   static Control& control();
+ *   static bool transfer(const char *node, bool up, simtime_t& delay);  // false if lost
+ *
+ * Each application level is a tag type. The handler of a level is
+ * instantiated per node role and transport, and it is picked again only when
+ * the controller's fidelity generation changes, i.e. once per transition.
+ * The nodes do not test their layer for each message. A new level adds a tag
+ * and the overloads for it.
+ *
+ * A peer in another partition of a parallel run is reached through the
+ * controllers, which only accept messages due at least a lookahead ahead.
+ * Requests and answers for such peers therefore leave when their delay
+ * starts rather than after it, with the delay added to the send.
+ */
+struct FlowLevel {};    // layer 0: messages are flows of the FlowEngine
+struct DirectLevel {};  // layer 1: one delayed message per request and answer
+struct BatchedLevel {}; // layer 1 with directBatching: answers collected once per epoch
+
+/**
+ * Parent side. Node must declare the role a friend and provide
+ * `propagationDelay`, `frequency`, `data` (a SensorStore) and the
+ * `directArrival` signal. It may hide isParentReady() to hold back direct
+ * traffic until its window is committed. A TCP server that sends layer-3
+ * bulk replies also provides the `msgsSent` and `bytesSent` counters.
+ */
+template <class Node, class Transport>
+class DirectParentRole {
+
+    protected:
+        typedef typename Transport::Control Control;
+        typedef typename Transport::Kind Kind;
+
+        simtime_t lastDirectMsgTime = 0;
+
+        // false if msg is not part of the direct exchange with the children
+        bool handleParentMessage(cMessage *msg) {
+            if (parentGeneration != Transport::control().getFidelityGeneration())
+                selectParentHandler();
+            return (this->*parentHandler)(msg);
+        }
+
+        bool isParentReady() const { return true; }
+
+        // layer 3: the whole reply goes to the client's app as one message, which
+        // arrives when a TCP bulk transfer of its size would have finished
+        void sendBulkReply(Packet *packet, const string& client, simtime_t delay) {
+            Control& control = Transport::control();
+            packet->clearTags();
+            packet->setKind(Kind::BULK_REPLY);
+            node().msgsSent++;
+            node().bytesSent += packet->getByteLength();
+            node().emit(packetSentSignal, packet);
+
+            simtime_t transfer = control.getBulkCompletionTime(hostName(), client.c_str(), packet->getByteLength());
+            EV_INFO << "sending \"" << packet->getName() << "\" to " << client << " as a bulk transfer of " << transfer << ", " << packet->getByteLength() << " bytes\n";
+            const DirectPeer& peer = control.getPeer(client);
+            node().sendDirect(packet, delay + transfer, 0, peer.app, peer.appInGateId);
+        }
+
+    private:
+        typedef bool (DirectParentRole::*Handler)(cMessage *msg);
+        Handler parentHandler = &DirectParentRole::handleInactive;
+        long parentGeneration = -1;
+
+        Node& node() { return static_cast<Node&>(*this); }
+        const char *hostName() { return node().getParentModule()->getFullName(); }
+
+        void selectParentHandler() {
+            Control& control = Transport::control();
+            const char *name = hostName();
+            parentGeneration = control.getFidelityGeneration();
+            int layer = control.getSwitchStatus(name) && node().isParentReady() ? control.getState(name) : -1;
+            if (layer == 0)
+                parentHandler = &DirectParentRole::template handleActive<FlowLevel>;
+            else if (layer == 1 && control.isBatched(name))
+                parentHandler = &DirectParentRole::template handleActive<BatchedLevel>;
+            else if (layer == 1)
+                parentHandler = &DirectParentRole::template handleActive<DirectLevel>;
+            else
+                parentHandler = &DirectParentRole::handleInactive;
+        }
+
+        template <class Level>
+        bool handleActive(cMessage *msg) {
+            Control& control = Transport::control();
+            switch (msg->getKind()) {
+                case Kind::TIMER:
+                case Kind::INIT_TIMER:
+                    lastDirectMsgTime = simTime();
+                    node().scheduleAt(simTime() + node().frequency, control.acquireMessage(nullptr, Kind::TIMER));
+                    control.releaseMessage(msg);
+                    startEpoch(Level());
+                    return true;
+                case Kind::APP_SELF_MSG:
+                    sendRequests(Level(), SIMTIME_ZERO);
+                    control.releaseMessage(msg);
+                    return true;
+                case Kind::APP_MSG_RETURNED:
+                    receiveAnswer(msg->getSenderModuleId(), lastDirectMsgTime, simTime());
+                    control.releaseMessage(msg);
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // packet level: TIMERs left over from a window still bring in its last batch
+        bool handleInactive(cMessage *msg) {
+            if (!msg->isSelfMessage() || msg->getKind() != Kind::TIMER)
+                return false;
+            receiveBatch();
+            Transport::control().releaseMessage(msg);
+            return true;
+        }
+
+        void startEpoch(FlowLevel) {
+            // the flow engine adds the delay
+            node().scheduleAt(simTime(), Transport::control().acquireMessage(nullptr, Kind::APP_SELF_MSG));
+        }
+
+        void startEpoch(DirectLevel) {
+            simtime_t delay = Transport::control().getChildDelay(hostName(), node().propagationDelay);
+            sendRequests(DirectLevel(), delay, true);
+            node().scheduleAt(simTime() + delay, Transport::control().acquireMessage(nullptr, Kind::APP_SELF_MSG));
+        }
+
+        void startEpoch(BatchedLevel) {
+            // the request goes straight to each child, the delay that APP_SELF_MSG would wait included
+            receiveBatch();
+            sendRequests(BatchedLevel(), Transport::control().getChildDelay(hostName(), node().propagationDelay));
+        }
+
+        // remote: the children in other partitions, otherwise the local ones
+        template <class Level>
+        void sendRequests(Level level, simtime_t delay, bool remote = false) {
+            Control& control = Transport::control();
+            for (const string& child : control.getChildren(hostName())) {
+                if (control.isDirectLink(child.c_str()) && control.getPeer(child).remote == remote)
+                    sendRequest(level, child, delay);
+            }
+        }
+
+        void sendRequest(FlowLevel, const string& child, simtime_t) {
+            Control& control = Transport::control();
+            control.sendFlow(hostName(), child.c_str(), control.acquireMessage(nullptr, Kind::APP_MSG_SENT));
+        }
+
+        template <class Level>
+        void sendRequest(Level, const string& child, simtime_t delay) {
+            Control& control = Transport::control();
+            simtime_t transfer;
+            if (!Transport::transfer(child.c_str(), false, transfer))
+                return; // lost on the way
+            const DirectPeer& peer = control.getPeer(child);
+            if (peer.remote)
+                control.sendToPartition(peer, control.acquireMessage(nullptr, Kind::APP_MSG_SENT), delay + transfer);
+            else
+                node().sendDirect(control.acquireMessage(nullptr, Kind::APP_MSG_SENT), delay + transfer, 0, peer.app, peer.appInGateId);
+        }
+
+        void receiveAnswer(int source, simtime_t sent, simtime_t arrival) {
+            node().data.store(source, arrival, SIMTIME_DBL(arrival) - SIMTIME_DBL(sent));
+            node().emit(node().directArrival, SIMTIME_DBL(arrival) - SIMTIME_DBL(sent));
+            Transport::control().addDirectStats(sent, arrival);
+        }
+
+        void receiveBatch() {
+            for (const DirectRecord& record : Transport::control().collectDirect(hostName()))
+                receiveAnswer(record.source, record.sent, record.arrival);
+        }
+};
+
+/**
+ * Child side. Node must declare the role a friend and provide
+ * `propagationDelay`. Requests that arrive after the window closed are still
+ * answered at layer 1.
+ *
+ * The role also keeps the packet-level request the node sent its parent until
+ * the reply arrives: Node calls requestSent() and replyArrived() around it.
+ * Only that request is migrated at STOP, a request still waiting for its send
+ * timer was never carried by the network.
+ */
+template <class Node, class Transport>
+class DirectChildRole {
+
+    protected:
+        typedef typename Transport::Control Control;
+        typedef typename Transport::Kind Kind;
+
+        // false if msg is not a request of the parent or part of answering one
+        bool handleChildMessage(cMessage *msg) {
+            if (msg->getKind() == Kind::MIGRATED_REPLY) {
+                // modeled, so it counts as a direct message rather than a packet-level round trip
+                Transport::control().addDirectStats(msg->getTimestamp(), simTime());
+                Transport::control().releaseMessage(msg);
+                return true;
+            }
+            if (childGeneration != Transport::control().getFidelityGeneration())
+                selectChildHandler();
+            return (this->*childHandler)(msg);
+        }
+
+        void requestSent() { requestInFlight = simTime(); }
+
+        // a reply answers the latest request, those before it were lost; its
+        // round trip calibrates the delay model if measured at packet level
+        void replyArrived(bool measured = true) {
+            if (measured && requestInFlight >= SIMTIME_ZERO)
+                Transport::control().addRoundTrip(hostName(), requestInFlight, simTime());
+            requestInFlight = -1;
+        }
+        void clearInFlight() { requestInFlight = -1; }
+
+        // at STOP: the reply to the request in flight arrives as a MIGRATED_REPLY; false if none was
+        bool migrateInFlight() {
+            if (requestInFlight < SIMTIME_ZERO)
+                return false;
+            Control& control = Transport::control();
+            simtime_t arrival;
+            if (control.getMigratedArrival(hostName(), requestInFlight, node().propagationDelay, arrival)) {
+                cMessage *reply = control.acquireMessage("migrated_reply", Kind::MIGRATED_REPLY);
+                reply->setTimestamp(requestInFlight);
+                node().scheduleAt(arrival, reply);
+            }
+            requestInFlight = -1;
+            return true;
+        }
+
+    private:
+        typedef bool (DirectChildRole::*Handler)(cMessage *msg);
+        Handler childHandler = &DirectChildRole::template handleAt<DirectLevel>;
+        long childGeneration = -1;
+        simtime_t requestInFlight = -1; // sent, negative if none
+
+        Node& node() { return static_cast<Node&>(*this); }
+        const char *hostName() { return node().getParentModule()->getFullName(); }
+
+        void selectChildHandler() {
+            Control& control = Transport::control();
+            const char *name = hostName();
+            childGeneration = control.getFidelityGeneration();
+            if (control.getState(name) == 0)
+                childHandler = &DirectChildRole::template handleAt<FlowLevel>;
+            else if (control.isBatched(name))
+                childHandler = &DirectChildRole::template handleAt<BatchedLevel>;
+            else
+                childHandler = &DirectChildRole::template handleAt<DirectLevel>;
+        }
+
+        template <class Level>
+        bool handleAt(cMessage *msg) {
+            switch (msg->getKind()) {
+                case Kind::APP_MSG_SENT:
+                    answer(Level(), msg);
+                    return true;
+                case Kind::APP_SELF_MSG_CLIENT:
+                    sendAnswer(msg);
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        void answer(FlowLevel, cMessage *request) {
+            // the answer goes back as part of the flow to the parent
+            Control& control = Transport::control();
+            control.releaseMessage(request);
+            control.sendFlow(hostName(), control.getParent(hostName()).c_str(), control.acquireMessage(nullptr, Kind::APP_MSG_RETURNED));
+        }
+
+        void answer(BatchedLevel, cMessage *request) {
+            // the answer waits in the parent's batch until its next TIMER
+            Control& control = Transport::control();
+            const char *name = hostName();
+            simtime_t transfer;
+            if (Transport::transfer(name, true, transfer))
+                control.postDirect(name, node().getId(), request->getSendingTime(), simTime() + control.getParentDelay(name, node().propagationDelay) + transfer);
+            control.releaseMessage(request);
+        }
+
+        void answer(DirectLevel, cMessage *request) {
+            Control& control = Transport::control();
+            control.releaseMessage(request);
+            simtime_t delay = control.getParentDelay(hostName(), node().propagationDelay);
+            if (control.getPeer(control.getParent(hostName())).remote)
+                sendAnswer(control.acquireMessage(nullptr, Kind::APP_SELF_MSG_CLIENT), delay);
+            else
+                node().scheduleAt(simTime() + delay, control.acquireMessage(nullptr, Kind::APP_SELF_MSG_CLIENT));
+        }
+
+        void sendAnswer(cMessage *msg, simtime_t delay = SIMTIME_ZERO) {
+            Control& control = Transport::control();
+            const char *name = hostName();
+            simtime_t transfer;
+            if (!Transport::transfer(name, true, transfer)) {
+                control.releaseMessage(msg); // lost on the way
+                return;
+            }
+            msg->setKind(Kind::APP_MSG_RETURNED);
+            const DirectPeer& parent = control.getPeer(control.getParent(name));
+            if (parent.remote)
+                control.sendToPartition(parent, msg, delay + transfer);
+            else
+                node().sendDirect(msg, delay + transfer, 0, parent.app, parent.appInGateId);
+        }
+};
+
+}
+
+#endif /* COMMON_DIRECTROLES_H_ */
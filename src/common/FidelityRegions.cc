@@ -0,0 +1,64 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "FidelityRegions.h"
+
+namespace inet {
+
+void FidelityRegions::parse(const char *spec) {
+    cStringTokenizer regionTokenizer(spec, ";");
+    while (regionTokenizer.hasMoreTokens()) {
+        string region = regionTokenizer.nextToken();
+        size_t colon = region.find(':');
+        if (colon == string::npos)
+            throw cRuntimeError("Invalid region \"%s\": expected \"name: node node ...\"", region.c_str());
+
+        vector<string> name = cStringTokenizer(region.substr(0, colon).c_str()).asVector();
+        if (name.size() != 1)
+            throw cRuntimeError("Invalid region name in \"%s\"", region.c_str());
+        if (regions.count(name[0]))
+            throw cRuntimeError("Region \"%s\" defined twice", name[0].c_str());
+        vector<string> nodes = cStringTokenizer(region.substr(colon + 1).c_str()).asVector();
+        regions[name[0]].insert(nodes.begin(), nodes.end());
+    }
+}
+
+bool FidelityRegions::has(const string& region) const {
+    return region.empty() || regions.count(region);
+}
+
+bool FidelityRegions::contains(const string& region, const string& node) const {
+    if (region.empty())
+        return true;
+    auto it = regions.find(region);
+    if (it == regions.end())
+        return false;
+    return it->second.count(node) > 0;
+}
+
+bool FidelityRegions::disjoint(const string& a, const string& b) const {
+    if (a.empty() || b.empty())
+        return false;
+    auto it = regions.find(a);
+    if (it == regions.end())
+        return true;
+    for (const string& node : it->second) {
+        if (contains(b, node))
+            return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,51 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef COMMON_FIDELITYREGIONS_H_
+#define COMMON_FIDELITYREGIONS_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+namespace inet {
+
+/**
+ * Named groups of hosts that switch fidelity together, e.g.
+ * "cluster1: DF1 SN1 SN2; cluster2: DF2 SN3 SN4".
+ * The empty region name stands for the whole network.
+ */
+class FidelityRegions {
+
+    private:
+        std::map<string, std::set<string>> regions; // sets, so that large generated regions stay cheap to look up
+
+    public:
+        void parse(const char *spec);
+
+        bool has(const string& region) const;
+        bool contains(const string& region, const string& node) const;
+        bool disjoint(const string& a, const string& b) const;
+};
+
+}
+
+#endif /* COMMON_FIDELITYREGIONS_H_ */
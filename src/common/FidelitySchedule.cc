@@ -0,0 +1,78 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "FidelitySchedule.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace inet {
+
+// layers 0 to 3; atoi() would take a typo for layer 0
+static int parseLayer(const char *text, const string& window) {
+    char *end;
+    long layer = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || layer < 0 || layer > 3)
+        throw cRuntimeError("Invalid layer \"%s\" in %s: expected an integer from 0 to 3", text, window.c_str());
+    return layer;
+}
+
+void FidelitySchedule::parse(const char *spec) {
+    cStringTokenizer windowTokenizer(spec, ";");
+    while (windowTokenizer.hasMoreTokens()) {
+        const char *window = windowTokenizer.nextToken();
+        std::vector<std::string> fields = cStringTokenizer(window).asVector();
+        if (fields.empty())
+            continue;
+        if (fields.size() != 3 && fields.size() != 4)
+            throw cRuntimeError("Invalid fidelity window \"%s\": expected \"start end layer [region]\"", window);
+        add(SimTime::parse(fields[0].c_str()), SimTime::parse(fields[1].c_str()), parseLayer(fields[2].c_str(), string("fidelity window \"") + window + "\""), fields.size() == 4 ? fields[3] : "");
+    }
+}
+
+void FidelitySchedule::parse(const cXMLElement *root) {
+    for (cXMLElement *window : root->getChildrenByTagName("window")) {
+        const char *start = window->getAttribute("start");
+        const char *end = window->getAttribute("end");
+        const char *layer = window->getAttribute("layer");
+        const char *region = window->getAttribute("region");
+        if (!start || !end || !layer)
+            throw cRuntimeError("<window> at %s needs start, end and layer attributes", window->getSourceLocation());
+        add(SimTime::parse(start), SimTime::parse(end), parseLayer(layer, string("<window> at ") + window->getSourceLocation()), region ? region : "");
+    }
+}
+
+void FidelitySchedule::add(simtime_t start, simtime_t end, int layer, const string& region) {
+    windows.push_back({start, end, layer, region});
+}
+
+void FidelitySchedule::validate(const FidelityRegions& regions) {
+    std::sort(windows.begin(), windows.end(), [](const FidelityWindow& a, const FidelityWindow& b) {
+        return a.start < b.start;
+    });
+
+    for (size_t i = 0; i < windows.size(); i++) {
+        if (windows[i].end <= windows[i].start)
+            throw cRuntimeError("Fidelity window %s..%s ends before it starts", windows[i].start.str().c_str(), windows[i].end.str().c_str());
+        if (!regions.has(windows[i].region))
+            throw cRuntimeError("Fidelity window at %s uses unknown region \"%s\"", windows[i].start.str().c_str(), windows[i].region.c_str());
+        for (size_t j = 0; j < i; j++) {
+            if (windows[i].start < windows[j].end && !regions.disjoint(windows[i].region, windows[j].region))
+                throw cRuntimeError("Fidelity windows starting at %s and %s overlap", windows[j].start.str().c_str(), windows[i].start.str().c_str());
+        }
+    }
+}
+
+}
@@ -0,0 +1,72 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef COMMON_FIDELITYSCHEDULE_H_
+#define COMMON_FIDELITYSCHEDULE_H_
+
+#include <vector>
+#include <omnetpp.h>
+
+#include "FidelityRegions.h"
+
+using namespace omnetpp;
+using std::vector;
+
+namespace inet {
+
+/**
+ * One abstraction window: between start and end the hosts of `region` (the
+ * whole network if empty) are simulated with `layer` layers instead of the
+ * controller's currentLayer.
+ */
+struct FidelityWindow {
+    simtime_t start;
+    simtime_t end;
+    int layer;
+    string region;
+};
+
+// layers 0 (flows) and 1 (direct messages) replace the packet exchange of the applications
+inline bool isApplicationLevel(int layer) { return layer == 0 || layer == 1; }
+
+/**
+ * Ordered list of abstraction windows read by the experiment controllers.
+ *
+ * String form:  "100s 200s 1; 400s 450s 2 cluster1"
+ * XML form:     <schedule><window start="100s" end="200s" layer="1" region="cluster1"/></schedule>
+ *
+ * Windows may only overlap if they switch disjoint regions.
+ */
+class FidelitySchedule {
+
+    private:
+        vector<FidelityWindow> windows;
+
+    public:
+        void parse(const char *spec);
+        void parse(const cXMLElement *root);
+        void add(simtime_t start, simtime_t end, int layer, const string& region = "");
+
+        // sorts windows by start time; throws if any overlap or are empty
+        void validate(const FidelityRegions& regions);
+
+        bool empty() const { return windows.empty(); }
+        size_t size() const { return windows.size(); }
+        const FidelityWindow& operator[](size_t i) const { return windows.at(i); }
+};
+
+}
+
+#endif /* COMMON_FIDELITYSCHEDULE_H_ */
@@ -0,0 +1,171 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "FlowEngine.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace inet {
+
+static const double COMPLETION_EPSILON = 1e-6; // bits left over from rounding
+static const double COMPLETION_SLACK = 1e-9; // seconds; finer than this is lost to simtime rounding
+
+static bool isSent(double remainingBits, double rate) {
+    return remainingBits <= std::max(COMPLETION_EPSILON, rate * COMPLETION_SLACK);
+}
+
+void FlowEngine::clear() {
+    flows.clear();
+    lastUpdate = SIMTIME_ZERO;
+    numRateUpdates = 0;
+}
+
+void FlowEngine::add(simtime_t now, const string& source, const string& destination, const vector<cDatarateChannel*>& channels, int64_t bits, cMessage *msg) {
+    advance(now);
+    auto key = std::make_pair(source, destination);
+    bool started = flows.find(key) == flows.end();
+    Flow& flow = flows[key];
+    if (started) {
+        flow.channels = channels;
+        flow.propagationDelay = SIMTIME_ZERO;
+        for (cDatarateChannel *channel : channels) {
+            if (channel)
+                flow.propagationDelay += channel->getDelay();
+        }
+    }
+    flow.backlog.push_back({msg, (double)bits});
+    if (started)
+        assignRates();
+}
+
+void FlowEngine::advance(simtime_t now) {
+    double elapsed = (now - lastUpdate).dbl();
+    lastUpdate = now;
+    if (elapsed <= 0)
+        return;
+    for (auto& entry : flows) {
+        Flow& flow = entry.second;
+        if (std::isinf(flow.rate)) {
+            for (Transfer& transfer : flow.backlog)
+                transfer.remainingBits = 0;
+            continue;
+        }
+        double budget = flow.rate * elapsed;
+        for (Transfer& transfer : flow.backlog) {
+            if (budget <= 0)
+                break;
+            double sent = std::min(budget, transfer.remainingBits);
+            transfer.remainingBits -= sent;
+            budget -= sent;
+        }
+    }
+}
+
+void FlowEngine::assignRates() {
+    numRateUpdates++;
+
+    // progressive filling: repeatedly fix the flows of the channel with the smallest fair share
+    std::map<cDatarateChannel*, double> capacity;
+    std::map<cDatarateChannel*, int> users;
+    vector<Flow*> unfixed;
+    for (auto& entry : flows) {
+        Flow& flow = entry.second;
+        flow.rate = INFINITY;
+        bool limited = false;
+        for (cDatarateChannel *channel : flow.channels) {
+            if (!channel || channel->getDatarate() <= 0)
+                continue;
+            capacity[channel] = channel->getDatarate();
+            users[channel]++;
+            limited = true;
+        }
+        if (limited)
+            unfixed.push_back(&flow);
+    }
+    while (!unfixed.empty()) {
+        cDatarateChannel *bottleneck = nullptr;
+        double share = INFINITY;
+        for (const auto& entry : users) {
+            if (entry.second > 0 && capacity[entry.first] / entry.second < share) {
+                bottleneck = entry.first;
+                share = capacity[entry.first] / entry.second;
+            }
+        }
+        if (!bottleneck)
+            break;
+        for (auto it = unfixed.begin(); it != unfixed.end(); ) {
+            Flow *flow = *it;
+            bool crosses = false;
+            for (cDatarateChannel *channel : flow->channels)
+                crosses = crosses || channel == bottleneck;
+            if (!crosses) {
+                ++it;
+                continue;
+            }
+            flow->rate = share;
+            for (cDatarateChannel *channel : flow->channels) {
+                if (users.count(channel)) {
+                    capacity[channel] -= share;
+                    users[channel]--;
+                }
+            }
+            it = unfixed.erase(it);
+        }
+    }
+}
+
+simtime_t FlowEngine::getNextCompletion() const {
+    simtime_t next = -1;
+    for (const auto& entry : flows) {
+        const Flow& flow = entry.second;
+        if (flow.backlog.empty())
+            continue;
+        double remaining = flow.backlog.front().remainingBits;
+        simtime_t completion = lastUpdate;
+        if (!std::isinf(flow.rate) && !isSent(remaining, flow.rate)) {
+            if (flow.rate <= 0)
+                continue;
+            completion += remaining / flow.rate;
+        }
+        if (next < SIMTIME_ZERO || completion < next)
+            next = completion;
+    }
+    return next;
+}
+
+vector<FlowEngine::Delivery> FlowEngine::collect(simtime_t now) {
+    advance(now);
+    vector<Delivery> deliveries;
+    bool stopped = false;
+    for (auto it = flows.begin(); it != flows.end(); ) {
+        Flow& flow = it->second;
+        while (!flow.backlog.empty() && (std::isinf(flow.rate) || isSent(flow.backlog.front().remainingBits, flow.rate))) {
+            deliveries.push_back({flow.backlog.front().msg, it->first.second, flow.propagationDelay});
+            flow.backlog.pop_front();
+        }
+        if (flow.backlog.empty()) {
+            it = flows.erase(it);
+            stopped = true;
+        } else {
+            ++it;
+        }
+    }
+    if (stopped)
+        assignRates();
+    return deliveries;
+}
+
+}
@@ -0,0 +1,87 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef COMMON_FLOWENGINE_H_
+#define COMMON_FLOWENGINE_H_
+
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+namespace inet {
+
+/**
+ * Flow-level (fluid) model of the application streams for layer 0.
+ *
+ * Each (source, destination) pair with messages in transit is a flow over
+ * the channels of its route. Flows share every channel max-min fairly up to
+ * the channel's datarate; a flow sends its messages one after the other at
+ * its rate, so a backlog shows up as queueing delay. Rates are recomputed
+ * only when a flow starts or stops. The engine only keeps state: the owner
+ * asks for the next completion time and collects the finished messages.
+ */
+class FlowEngine {
+
+    public:
+        struct Delivery {
+            cMessage *msg;
+            string destination;
+            simtime_t propagationDelay; // still to be added on top of the completion time
+        };
+
+    private:
+        struct Transfer {
+            cMessage *msg;
+            double remainingBits;
+        };
+        struct Flow {
+            vector<cDatarateChannel*> channels;
+            simtime_t propagationDelay;
+            std::deque<Transfer> backlog;
+            double rate = 0; // bit/s, infinite if no channel limits it
+        };
+        std::map<std::pair<string, string>, Flow> flows;
+        simtime_t lastUpdate;
+        long numRateUpdates = 0;
+
+        void advance(simtime_t now);
+        void assignRates();
+
+    public:
+        // forgets all flows; pending messages belong to their owner module
+        void clear();
+
+        void add(simtime_t now, const string& source, const string& destination, const vector<cDatarateChannel*>& channels, int64_t bits, cMessage *msg);
+
+        // earliest completion of a message in transit, negative if there is none
+        simtime_t getNextCompletion() const;
+
+        // messages fully sent by `now`; flows left without messages stop
+        vector<Delivery> collect(simtime_t now);
+
+        size_t getNumFlows() const { return flows.size(); }
+        long getNumRateUpdates() const { return numRateUpdates; }
+};
+
+}
+
+#endif /* COMMON_FLOWENGINE_H_ */
@@ -0,0 +1,190 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#include "ForkPoint.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "omnetpp/cconfigoption.h"
+#include "ColumnarRecorder.h"
+
+namespace inet {
+
+vector<string> ForkPoint::parseBranches(const char *spec) {
+    vector<string> branches;
+    string s = spec;
+    if (s.find_first_not_of(" \t\n") == string::npos)
+        return branches;
+    size_t start = 0;
+    while (true) {
+        size_t end = s.find('|', start);
+        branches.push_back(s.substr(start, end == string::npos ? string::npos : end - start));
+        if (end == string::npos)
+            break;
+        start = end + 1;
+    }
+    return branches;
+}
+
+#ifdef _WIN32
+
+int ForkPoint::fork(int numBranches, const char *directory) {
+    throw cRuntimeError("Forking the simulation needs a POSIX system");
+}
+
+void ForkPoint::waitForBranches() {
+}
+
+#else
+
+static void makeDirectory(const string& path) {
+    if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST)
+        throw cRuntimeError("Cannot create fork directory \"%s\": %s", path.c_str(), strerror(errno));
+}
+
+static void makeDirectories(const string& path) {
+    for (size_t end = path.find('/', 1); end != string::npos; end = path.find('/', end + 1))
+        makeDirectory(path.substr(0, end));
+}
+
+// a result file the process has open, by the path it was opened with; the
+// offset is shared with the children, so it is taken before they start writing
+struct OpenResult {
+    int fd;
+    string path;
+    int flags;
+    off_t offset;
+};
+
+static const char *RESULT_FILE_OPTIONS[] = {"output-vector-file", "output-scalar-file", "columnar-output"};
+
+static vector<OpenResult> findOpenResults() {
+    vector<OpenResult> results;
+    long maxFd = std::min(sysconf(_SC_OPEN_MAX), 65536L);
+    for (const char *name : RESULT_FILE_OPTIONS) {
+        cConfigOption *option = cConfigOption::find(name);
+        if (option == nullptr)
+            continue;
+        string path = getEnvir()->getConfig()->getAsFilename(option);
+        // files opened after the fork are found relative to the branch directory
+        if (!path.empty() && path[0] == '/')
+            throw cRuntimeError("Forking needs a relative %s, not \"%s\"", name, path.c_str());
+        struct stat file;
+        if (path.empty() || stat(path.c_str(), &file) != 0)
+            continue;
+        for (int fd = 3; fd < maxFd; fd++) {
+            struct stat opened;
+            if (fstat(fd, &opened) == 0 && opened.st_dev == file.st_dev && opened.st_ino == file.st_ino)
+                results.push_back({fd, path, fcntl(fd, F_GETFL), lseek(fd, 0, SEEK_CUR)});
+        }
+    }
+    return results;
+}
+
+static void copyResult(const OpenResult& result, const string& copy) {
+    makeDirectories(copy);
+    std::ifstream in(result.path, std::ios::binary);
+    std::ofstream out(copy, std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+    if (!in || !out)
+        throw cRuntimeError("Cannot copy \"%s\" to \"%s\"", result.path.c_str(), copy.c_str());
+}
+
+// the descriptor that the output manager writes through now writes the copy, at the same offset
+static void redirectResult(const OpenResult& result, const string& copy) {
+    int fd = open(copy.c_str(), result.flags & (O_ACCMODE | O_APPEND));
+    if (result.flags < 0 || result.offset < 0 || fd < 0 || lseek(fd, result.offset, SEEK_SET) < 0 || dup2(fd, result.fd) < 0)
+        throw cRuntimeError("Cannot redirect \"%s\" to \"%s\": %s", result.path.c_str(), copy.c_str(), strerror(errno));
+    close(fd);
+}
+
+/**
+ * Ends a forked branch with its run. Cmdenv would otherwise go on with the
+ * next runs of its invocation in every branch. The result files of the run
+ * are closed before the next network is set up.
+ */
+class BranchExit : public cISimulationLifecycleListener {
+
+    private:
+        bool failed = false;
+
+    public:
+        virtual void lifecycleEvent(SimulationLifecycleEventType eventType, cObject *details) override {
+            if (eventType == LF_ON_SIMULATION_ERROR)
+                failed = true;
+            else if (eventType == LF_PRE_NETWORK_SETUP || eventType == LF_ON_SHUTDOWN) {
+                fflush(nullptr);
+                _exit(failed ? 1 : 0);
+            }
+        }
+};
+
+int ForkPoint::fork(int numBranches, const char *directory) {
+    // buffered output would otherwise be written once by every process
+    fflush(nullptr);
+    ColumnarWriter::getInstance().flush();
+    vector<OpenResult> results = findOpenResults();
+    makeDirectory(directory);
+    for (int i = 1; i <= numBranches; i++) {
+        string path = string(directory) + "/" + std::to_string(i);
+        makeDirectory(path);
+        // copied while the parent is still here, so the copies end at the fork
+        for (const OpenResult& result : results)
+            copyResult(result, path + "/" + result.path);
+        pid_t pid = ::fork();
+        if (pid < 0)
+            throw cRuntimeError("Cannot fork branch %d: %s", i, strerror(errno));
+        if (pid == 0) {
+            children.clear();
+            branch = i;
+            for (const OpenResult& result : results)
+                redirectResult(result, path + "/" + result.path);
+            if (chdir(path.c_str()) != 0)
+                throw cRuntimeError("Cannot enter fork directory \"%s\": %s", path.c_str(), strerror(errno));
+            getEnvir()->addLifecycleListener(new BranchExit());
+            return branch;
+        }
+        children.push_back(pid);
+    }
+    return branch;
+}
+
+void ForkPoint::waitForBranches() {
+    int failed = 0;
+    for (int pid : children) {
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+    children.clear();
+    if (failed > 0)
+        throw cRuntimeError("%d forked branches did not finish cleanly", failed);
+}
+
+#endif
+
+}
@@ -0,0 +1,68 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef COMMON_FORKPOINT_H_
+#define COMMON_FORKPOINT_H_
+
+#include <string>
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+namespace inet {
+
+/**
+ * Splits a running simulation into branches at a fidelity boundary, so that
+ * several what-if continuations share one warm-up prefix.
+ *
+ * The snapshot is the process itself: fork() copies every module with its
+ * counters and request queues, the controller singleton, the RNG states and
+ * the future event set, which no hand-written checkpoint could cover for
+ * INET's protocol modules. Each child continues in its own working directory
+ * `<directory>/<branch>`. Result files that are open at the fork (vectors,
+ * scalars, columnar output) are copied there first, and the child's
+ * descriptors are pointed at the copies, so every branch has the warm-up and
+ * its own continuation. Files opened later are resolved relative to the
+ * branch directory, so the result file names must be relative. A child exits
+ * when its run is over rather than going on with the next runs of the
+ * invocation. The calling process stays branch 0 and waits for its children at
+ * the end of its run. Needs a POSIX system and Cmdenv.
+ */
+class ForkPoint {
+
+    private:
+        vector<int> children; // process ids, in the parent only
+        int branch = 0;
+
+    public:
+        // "spec | spec | ...", one fidelitySchedule per forked branch; a blank spec is a branch without windows
+        static vector<string> parseBranches(const char *spec);
+
+        // forks numBranches children; returns the branch of the calling process, 0 in the parent
+        int fork(int numBranches, const char *directory);
+
+        // blocks until all children have finished; throws if one of them failed
+        void waitForBranches();
+
+        int getBranch() const { return branch; }
+};
+
+}
+
+#endif /* COMMON_FORKPOINT_H_ */
@@ -0,0 +1,178 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#include "InstrumentedScheduler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "omnetpp/cconfigoption.h"
+
+namespace inet {
+
+Register_Class(InstrumentedScheduler);
+
+Register_PerRunConfigOption(CFGID_PROFILE_EVENTS, "profile-events", CFG_BOOL, "false", "Whether inet::InstrumentedScheduler profiles the wall-clock time of the events by module, message kind and fidelity.");
+Register_PerRunConfigOption(CFGID_PROFILE_OUTPUT, "profile-output", CFG_FILENAME, "${resultdir}/${configname}-${runnumber}.profile.csv", "Where inet::InstrumentedScheduler writes the event profile.");
+
+InstrumentedScheduler::FidelityProbe InstrumentedScheduler::fidelityProbe = nullptr;
+const cEnum *InstrumentedScheduler::appKinds = nullptr;
+
+void InstrumentedScheduler::setFidelityProbe(FidelityProbe probe, const char *kindEnum) {
+    fidelityProbe = probe;
+    appKinds = cEnum::find(kindEnum);
+}
+
+int InstrumentedScheduler::getFidelity(cModule *module) {
+    if (fidelityProbe == nullptr)
+        return -1;
+    // windows are entered per host, the submodules of the network
+    while (module != nullptr && module->getParentModule() != nullptr && module->getParentModule()->getParentModule() != nullptr)
+        module = module->getParentModule();
+    bool isHost = module != nullptr && module->getParentModule() != nullptr;
+    return fidelityProbe(isHost ? module->getFullName() : nullptr);
+}
+
+void InstrumentedScheduler::sampleClock(IClockListener *listener, simtime_t interval) {
+    if (interval <= SIMTIME_ZERO)
+        throw cRuntimeError("The clock sampling interval must be positive");
+    clockListener = listener;
+    clockInterval = interval;
+    nextSample = SIMTIME_ZERO;
+}
+
+cEvent *InstrumentedScheduler::takeNextEvent() {
+    cEvent *event = cSequentialScheduler::takeNextEvent();
+    if (clockListener != nullptr && event != nullptr && event->getArrivalTime() >= nextSample)
+        sampleClockUntil(event->getArrivalTime());
+    if (profiling && event != nullptr) {
+        charge();
+        current = entryFor(event);
+        current->events++;
+    }
+    return event;
+}
+
+void InstrumentedScheduler::sampleClockUntil(simtime_t time) {
+    ClockSample sample;
+    sample.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+    sample.cpuTime = (std::clock() - cpuStart) / (double) CLOCKS_PER_SEC;
+    sample.events = getSimulation()->getEventNumber();
+    // nothing happened in the sampling points skipped over, so they all see the same clocks
+    for (; nextSample <= time; nextSample += clockInterval) {
+        sample.time = nextSample;
+        clockListener->clockSampled(sample);
+    }
+}
+
+void InstrumentedScheduler::charge() {
+    auto now = std::chrono::steady_clock::now();
+    if (current != nullptr)
+        current->seconds += std::chrono::duration<double>(now - since).count();
+    since = now;
+}
+
+InstrumentedScheduler::Entry *InstrumentedScheduler::entryFor(cEvent *event) {
+    cMessage *msg = event->isMessage() ? static_cast<cMessage *>(event) : nullptr;
+    int moduleId = msg != nullptr ? msg->getArrivalModuleId() : -1;
+    short kind = msg != nullptr ? msg->getKind() : 0;
+    int fidelity = getFidelity(msg != nullptr ? msg->getArrivalModule() : nullptr);
+    uint64_t key = (uint64_t)(uint32_t)moduleId << 32 | (uint64_t)(uint16_t)kind << 16 | (uint16_t)fidelity;
+
+    auto it = entries.find(key);
+    if (it != entries.end())
+        return &it->second;
+    // labels are resolved once, the first time the combination runs
+    Entry& entry = entries[key];
+    entry.fidelity = fidelity;
+    entry.module = msg != nullptr ? msg->getArrivalModule()->getFullPath() : "-";
+    entry.kind = msg != nullptr ? kindOf(msg) : event->getClassName();
+    return &entry;
+}
+
+string InstrumentedScheduler::kindOf(cMessage *msg) const {
+    const char *type = msg->getArrivalModule()->getNedTypeName();
+    const cEnum *kinds = nullptr;
+    if (msg->getArrivalGate() != nullptr && msg->getArrivalGate()->isName("socketIn"))
+        kinds = cEnum::find(strstr(type, ".UDP.") != nullptr ? "inet::UdpStatusInd" : "inet::TcpStatusInd");
+    else if (strncmp(type, "research.", 9) == 0)
+        kinds = appKinds;
+    if (kinds != nullptr)
+        if (const char *name = kinds->getStringFor(msg->getKind()))
+            return name;
+    // INET's own timers and packets are better known by their names
+    if (!opp_isempty(msg->getName()))
+        return msg->getName();
+    return "kind " + std::to_string(msg->getKind());
+}
+
+void InstrumentedScheduler::dump() const {
+    std::vector<const Entry *> rows;
+    double total = 0;
+    for (auto& it : entries) {
+        rows.push_back(&it.second);
+        total += it.second.seconds;
+    }
+    std::sort(rows.begin(), rows.end(), [](const Entry *a, const Entry *b) { return a->seconds > b->seconds; });
+
+    std::ofstream out(output);
+    if (!out)
+        throw cRuntimeError("Cannot write the event profile to '%s'", output.c_str());
+    out << "module,kind,fidelity,events,seconds,share\n";
+    for (const Entry *row : rows)
+        out << row->module << ',' << row->kind << ',' << row->fidelity << ',' << row->events << ','
+            << row->seconds << ',' << (total > 0 ? row->seconds / total : 0) << '\n';
+}
+
+void InstrumentedScheduler::lifecycleEvent(SimulationLifecycleEventType eventType, cObject *details) {
+    cSequentialScheduler::lifecycleEvent(eventType, details);
+    switch (eventType) {
+        case LF_ON_SIMULATION_START:
+            profiling = getEnvir()->getConfig()->getAsBool(CFGID_PROFILE_EVENTS);
+            output = getEnvir()->getConfig()->getAsFilename(CFGID_PROFILE_OUTPUT);
+            entries.clear();
+            current = nullptr;
+            since = runStart = std::chrono::steady_clock::now();
+            cpuStart = std::clock();
+            break;
+        case LF_ON_SIMULATION_PAUSE:
+            // time spent stopped in the user interface belongs to no event
+            if (profiling) {
+                charge();
+                current = nullptr;
+            }
+            break;
+        case LF_ON_SIMULATION_RESUME:
+            since = std::chrono::steady_clock::now();
+            break;
+        case LF_PRE_NETWORK_FINISH:
+            if (profiling) {
+                charge();
+                current = nullptr;
+                dump();
+            }
+            break;
+        case LF_PRE_NETWORK_DELETE:
+            clockListener = nullptr;
+            break;
+        default:
+            break;
+    }
+}
+
+}
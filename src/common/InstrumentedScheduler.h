@@ -0,0 +1,114 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef COMMON_INSTRUMENTEDSCHEDULER_H_
+#define COMMON_INSTRUMENTEDSCHEDULER_H_
+
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::string;
+
+namespace inet {
+
+/**
+ * The sequential scheduler, timing the run as it takes the events.
+ *
+ * Selected with scheduler-class = "inet::InstrumentedScheduler". A listener
+ * registered with sampleClock() gets the wall-clock time, processor time and
+ * number of events of the run at every multiple of the interval in simulated
+ * time, taken just before the first event at or after it. Sampling adds no
+ * events, so it does not slow down the run it measures.
+ *
+ * With
+ * profile-events = true, the time from taking one event to taking the next
+ * is charged to the module the event arrived at, its message kind and the
+ * layer of the fidelity window its host was in, and the table is written to
+ * profile-output before the modules finish. Without it, taking an event is
+ * one extra branch; with the default scheduler it costs nothing at all.
+ *
+ * Parallel runs schedule through their synchronization protocol instead and
+ * are neither sampled nor profiled.
+ */
+class InstrumentedScheduler : public cSequentialScheduler {
+
+    public:
+        typedef int (*FidelityProbe)(const char *host); // host is null for the global layer
+
+        struct ClockSample {
+            simtime_t time;
+            double wallTime = 0; // monotonic clock, seconds since the simulation started
+            double cpuTime = 0; // processor time of the process over the same span
+            long events = 0; // events processed before the sample
+        };
+
+        class IClockListener {
+            public:
+                virtual ~IClockListener() {}
+                virtual void clockSampled(const ClockSample& sample) = 0;
+        };
+
+    private:
+        struct Entry {
+            string module;
+            string kind;
+            int fidelity = 0;
+            long events = 0;
+            double seconds = 0;
+        };
+
+        // set by the controller of the network, so the scheduler needs neither
+        static FidelityProbe fidelityProbe;
+        static const cEnum *appKinds;
+
+        bool profiling = false;
+        string output;
+        std::unordered_map<uint64_t, Entry> entries; // by module id, kind and layer
+        Entry *current = nullptr; // the event taken last, still running
+        std::chrono::steady_clock::time_point since;
+
+        IClockListener *clockListener = nullptr;
+        simtime_t clockInterval;
+        simtime_t nextSample;
+        std::chrono::steady_clock::time_point runStart;
+        std::clock_t cpuStart = 0;
+
+        void sampleClockUntil(simtime_t time);
+        Entry *entryFor(cEvent *event);
+        string kindOf(cMessage *msg) const;
+        void charge();
+        void dump() const;
+
+    public:
+        // layer of a host's active window, and the enum naming the kinds of the applications
+        static void setFidelityProbe(FidelityProbe probe, const char *kindEnum);
+        // layer of the host module belongs to, or the global one for modules outside any host
+        static int getFidelity(cModule *module);
+
+        // samples from simulated time 0 on, until the network is deleted
+        void sampleClock(IClockListener *listener, simtime_t interval);
+
+        virtual cEvent *takeNextEvent() override;
+        virtual void lifecycleEvent(SimulationLifecycleEventType eventType, cObject *details) override;
+};
+
+}
+
+#endif /* COMMON_INSTRUMENTEDSCHEDULER_H_ */
@@ -0,0 +1,55 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#include "MessagePool.h"
+
+#include <typeinfo>
+
+namespace inet {
+
+MessagePool::~MessagePool() {
+    for (cMessage *msg : free)
+        dropAndDelete(msg);
+}
+
+cMessage *MessagePool::acquire(const char *name, short kind) {
+    if (free.empty()) {
+        numCreated++;
+        return new cMessage(name, kind);
+    }
+    cMessage *msg = free.back();
+    free.pop_back();
+    numReused++;
+    drop(msg); // now owned by the calling module
+    msg->setName(name);
+    msg->setKind(kind);
+    msg->setSchedulingPriority(0);
+    msg->setTimestamp(SIMTIME_ZERO);
+    msg->setContextPointer(nullptr);
+    return msg;
+}
+
+void MessagePool::release(cMessage *msg) {
+    // packets, subclasses and anything still carrying state are not reused
+    if (typeid(*msg) != typeid(cMessage) || msg->isScheduled() || msg->getControlInfo() != nullptr || free.size() >= capacity) {
+        delete msg;
+        return;
+    }
+    take(msg);
+    free.push_back(msg);
+}
+
+}
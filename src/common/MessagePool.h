@@ -0,0 +1,60 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef COMMON_MESSAGEPOOL_H_
+#define COMMON_MESSAGEPOOL_H_
+
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::vector;
+
+namespace inet {
+
+/**
+ * Free list of plain cMessage objects for the control and direct-mode
+ * messages (TIMER, APP_*, STOP_*, RESTART_*), which are created and
+ * destroyed several times per node and epoch while a window is active.
+ *
+ * Messages in the pool are owned by it. acquire() hands one to the module
+ * whose code is running, like `new` would; release() takes it back, or
+ * deletes it if it is not a plain cMessage or the pool already holds
+ * `capacity` messages, so memory stays bounded across windows.
+ */
+class MessagePool : public cNoncopyableOwnedObject {
+
+    private:
+        vector<cMessage *> free;
+        size_t capacity;
+        long numCreated = 0;
+        long numReused = 0;
+
+    public:
+        explicit MessagePool(const char *name, size_t capacity = 1000) : cNoncopyableOwnedObject(name), capacity(capacity) {}
+        virtual ~MessagePool();
+
+        cMessage *acquire(const char *name, short kind);
+        void release(cMessage *msg);
+
+        long getNumCreated() const { return numCreated; }
+        long getNumReused() const { return numReused; }
+        size_t getNumFree() const { return free.size(); }
+};
+
+}
+
+#endif /* COMMON_MESSAGEPOOL_H_ */
@@ -0,0 +1,66 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#include "PartitionMap.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "omnetpp/cconfigurationex.h"
+
+namespace inet {
+
+void PartitionMap::build(cModule *controller) {
+    gates.clear();
+    lookaheads.clear();
+    numPartitions = std::max(1, getEnvir()->getParsimNumPartitions());
+    partition = isPartitioned() ? getEnvir()->getParsimProcId() : 0;
+
+    int numGates = controller->hasGate("peerOut", 0) ? controller->gateSize("peerOut") : 0;
+    for (int i = 0; i < numGates; i++) {
+        cGate *out = controller->gate("peerOut", i);
+        cGate *in = out->getPathEndGate();
+        cDelayChannel *channel = dynamic_cast<cDelayChannel *>(out->getChannel());
+        if (!in || in == out || !channel)
+            throw cRuntimeError("%s is not connected to another controller over a delay channel", out->getFullPath().c_str());
+        int peer = partitionOf(in->getOwnerModule());
+        if (peer == partition)
+            throw cRuntimeError("%s leads to a controller in its own partition %d", out->getFullPath().c_str(), partition);
+        gates[peer] = i;
+        lookaheads.push_back(channel->getDelay());
+    }
+    if (isPartitioned() && (int)gates.size() != numPartitions - 1)
+        throw cRuntimeError("%s needs a peerOut gate to each of the %d other partitions, has %d", controller->getFullPath().c_str(), numPartitions - 1, (int)gates.size());
+}
+
+int PartitionMap::partitionOf(cModule *module) {
+    for (; module; module = module->getParentModule()) {
+        const char *id = getEnvir()->getConfigEx()->getPerObjectConfigValue(module->getFullPath().c_str(), "partition-id");
+        if (id && *id)
+            return atoi(id);
+    }
+    return 0;
+}
+
+int PartitionMap::getGate(cModule *host) const {
+    int peer = partitionOf(host);
+    auto it = gates.find(peer);
+    if (it == gates.end())
+        throw cRuntimeError("No controller link towards partition %d of %s", peer, host->getFullPath().c_str());
+    return it->second;
+}
+
+}
@@ -0,0 +1,68 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef COMMON_PARTITIONMAP_H_
+#define COMMON_PARTITIONMAP_H_
+
+#include <map>
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::vector;
+
+namespace inet {
+
+/**
+ * Where the hosts of a parallel (parsim) run live, seen from the controller
+ * replica of one partition.
+ *
+ * Every partition runs its own controller on the same schedule, so the
+ * fidelity state is replicated instead of shared; what one replica has to
+ * tell another goes through its peerOut gates. Those are connected to the
+ * replicas of all other partitions over delay channels, and the delay of the
+ * channel to a partition is the lookahead towards it: nothing can be sent
+ * there for less. Hosts of other partitions are placeholder modules.
+ *
+ * In a sequential run there is one partition and no peer gates.
+ */
+class PartitionMap {
+
+    private:
+        int partition = 0;
+        int numPartitions = 1;
+        std::map<int, int> gates; // index of the peerOut gate towards each other partition
+        vector<simtime_t> lookaheads; // by peerOut index
+
+    public:
+        // reads the partition of the controller and the peerOut gates it is connected with
+        void build(cModule *controller);
+
+        bool isPartitioned() const { return numPartitions > 1; }
+        int getPartition() const { return partition; }
+        int getNumPartitions() const { return numPartitions; }
+
+        // partition-id configured for the module or its closest ancestor
+        static int partitionOf(cModule *module);
+
+        // peerOut gate towards the partition of a host, and its channel delay
+        int getGate(cModule *host) const;
+        simtime_t getLookahead(int gate) const { return lookaheads.at(gate); }
+};
+
+}
+
+#endif /* COMMON_PARTITIONMAP_H_ */
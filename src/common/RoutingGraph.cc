@@ -0,0 +1,152 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "RoutingGraph.h"
+
+#include <deque>
+
+#include "inet/networklayer/common/L3AddressResolver.h"
+
+namespace inet {
+
+void RoutingGraph::build(cModule *network) {
+    this->network = network;
+    hosts.clear();
+    parents.clear();
+    children.clear();
+    routes.clear();
+    hostByAddress.clear();
+
+    for (cModule::SubmoduleIterator it(network); !it.end(); ++it) {
+        cModule *host = *it;
+        if (host->isPlaceholder())
+            continue; // read by the partition it lives in
+        cModule *app = host->getSubmodule("app", 0);
+        if (!app)
+            continue;
+        hosts.push_back(host->getFullName());
+
+        const char *address = nullptr;
+        string firstDestination;
+        if (app->hasPar("connectAddress")) {
+            address = app->par("connectAddress");
+        } else if (app->hasPar("destAddresses")) {
+            vector<string> destinations = cStringTokenizer(app->par("destAddresses")).asVector();
+            if (destinations.size() > 1)
+                EV_WARN << host->getFullName() << " has several destAddresses, using " << destinations[0] << " as its parent" << endl;
+            if (!destinations.empty()) {
+                firstDestination = destinations[0];
+                address = firstDestination.c_str();
+            }
+        }
+        if (!address || !*address)
+            continue;
+
+        cModule *parent = resolveHost(address);
+        if (!parent)
+            throw cRuntimeError("Cannot resolve \"%s\" given as destination of %s", address, host->getFullPath().c_str());
+        parents[host->getFullName()] = parent->getFullName();
+        children[parent->getFullName()].push_back(host->getFullName());
+        routes[host->getFullName()] = findRoute(host, parent);
+    }
+}
+
+void RoutingGraph::addRemoteLink(const string& host, const string& parent) {
+    if (parents.count(host))
+        return;
+    parents[host] = parent;
+    children[parent].push_back(host);
+}
+
+cModule *RoutingGraph::resolveHost(const char *address) const {
+    // hosts of other partitions have no interfaces to resolve addresses with
+    cModule *named = network->getModuleByPath(("." + string(address)).c_str());
+    if (named && named->isPlaceholder())
+        return named;
+    L3Address result;
+    if (!L3AddressResolver().tryResolve(address, result) || result.isUnspecified())
+        return nullptr;
+    return L3AddressResolver().findHostWithAddress(result);
+}
+
+DirectRoute RoutingGraph::findRoute(cModule *from, cModule *to) const {
+    // breadth-first search over point-to-point connections, remembering the gate each module was reached through
+    std::map<cModule*, cGate*> reachedBy;
+    std::deque<cModule*> queue;
+    reachedBy[from] = nullptr;
+    queue.push_back(from);
+    while (!queue.empty() && !reachedBy.count(to)) {
+        cModule *module = queue.front();
+        queue.pop_front();
+        if (!module->hasGate("pppg$o"))
+            continue;
+        for (int i = 0; i < module->gateSize("pppg$o"); i++) {
+            cGate *out = module->gate("pppg$o", i);
+            cGate *next = out->getNextGate();
+            if (!next)
+                continue;
+            cModule *peer = next->getOwnerModule();
+            if (reachedBy.count(peer))
+                continue;
+            reachedBy[peer] = out;
+            queue.push_back(peer);
+        }
+    }
+    if (!reachedBy.count(to))
+        throw cRuntimeError("No pppg route from %s to %s", from->getFullPath().c_str(), to->getFullPath().c_str());
+
+    DirectRoute route;
+    for (cModule *module = to; module != from; ) {
+        cGate *out = reachedBy[module];
+        cGate *back = out->getOwnerModule()->gate("pppg$i", out->getIndex())->getPreviousGate();
+        route.up.insert(route.up.begin(), dynamic_cast<cDatarateChannel *>(out->getChannel()));
+        route.down.push_back(back ? dynamic_cast<cDatarateChannel *>(back->getChannel()) : nullptr);
+        module = out->getOwnerModule();
+    }
+    return route;
+}
+
+bool RoutingGraph::hasParent(const string& host) const {
+    return parents.count(host) > 0;
+}
+
+const string& RoutingGraph::getParent(const string& host) const {
+    auto it = parents.find(host);
+    if (it == parents.end())
+        throw cRuntimeError("Host %s has no parent in the routing graph", host.c_str());
+    return it->second;
+}
+
+const vector<string>& RoutingGraph::getChildren(const string& host) const {
+    static const vector<string> none;
+    auto it = children.find(host);
+    return it != children.end() ? it->second : none;
+}
+
+const DirectRoute& RoutingGraph::getRoute(const string& host) const {
+    auto it = routes.find(host);
+    if (it == routes.end())
+        throw cRuntimeError("Host %s has no route in the routing graph", host.c_str());
+    return it->second;
+}
+
+cModule *RoutingGraph::findHost(const L3Address& address) {
+    auto it = hostByAddress.find(address);
+    if (it == hostByAddress.end())
+        it = hostByAddress.emplace(address, L3AddressResolver().findHostWithAddress(address)).first;
+    return it->second;
+}
+
+}
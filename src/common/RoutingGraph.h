@@ -0,0 +1,85 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef COMMON_ROUTINGGRAPH_H_
+#define COMMON_ROUTINGGRAPH_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <omnetpp.h>
+
+#include "inet/networklayer/common/L3Address.h"
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+namespace inet {
+
+/**
+ * Channels crossed between a host and the host its application reports to.
+ */
+struct DirectRoute {
+    vector<cDatarateChannel*> up; // towards the parent
+    vector<cDatarateChannel*> down; // back to the host
+};
+
+/**
+ * Application-level tree of the network, used by direct mode instead of
+ * hard-coded host tables. A host's parent is the host named by the
+ * connectAddress (TCP) or first destAddresses entry (UDP) of its app[0];
+ * the route between them is the shortest chain of pppg connections.
+ *
+ * Hosts are keyed by full name. Must be built after network addresses are
+ * assigned (INITSTAGE_LAST).
+ *
+ * In a parallel run only the local hosts are read; a parent in another
+ * partition is found by name, and links whose child is remote are added
+ * later from what the other partitions report, without a route.
+ */
+class RoutingGraph {
+
+    private:
+        cModule *network = nullptr;
+        vector<string> hosts;
+        std::map<string, string> parents;
+        std::map<string, vector<string>> children;
+        std::map<string, DirectRoute> routes;
+        std::map<L3Address, cModule*> hostByAddress;
+
+        cModule *resolveHost(const char *address) const;
+        DirectRoute findRoute(cModule *from, cModule *to) const;
+
+    public:
+        void build(cModule *network);
+        void addRemoteLink(const string& host, const string& parent);
+
+        const vector<string>& getHosts() const { return hosts; }
+        const std::map<string, string>& getParents() const { return parents; }
+
+        bool hasParent(const string& host) const;
+        const string& getParent(const string& host) const;
+        const vector<string>& getChildren(const string& host) const;
+        bool hasRoute(const string& host) const { return routes.count(host) > 0; }
+        const DirectRoute& getRoute(const string& host) const;
+
+        // host owning an interface address, cached
+        cModule *findHost(const L3Address& address);
+};
+
+}
+
+#endif /* COMMON_ROUTINGGRAPH_H_ */
@@ -0,0 +1,74 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#include "SensorStore.h"
+
+namespace inet {
+
+void SensorStore::configure(int capacity, simtime_t retention) {
+    if (capacity < 1)
+        throw cRuntimeError("A sensor store needs a capacity of at least 1, got %d", capacity);
+    ring.assign(capacity, SensorReading());
+    first = count = 0;
+    newest = SIMTIME_ZERO;
+    this->retention = retention;
+    numReceived = 0;
+}
+
+void SensorStore::expire(simtime_t now) {
+    if (retention < SIMTIME_ZERO)
+        return;
+    while (count > 0 && at(0).time < now - retention) {
+        first = (first + 1) % ring.size();
+        count--;
+    }
+}
+
+void SensorStore::store(int source, simtime_t time, double value) {
+    numReceived++;
+    if (time > newest)
+        newest = time;
+    expire(newest);
+    if (retention >= SIMTIME_ZERO && time < newest - retention)
+        return; // already outside the window
+    if (count == ring.size()) {
+        if (time < at(0).time)
+            return; // older than everything held, it would be overwritten first
+        first = (first + 1) % ring.size();
+        count--;
+    }
+    // batched answers can be stored after later ones, keep the ring sorted by arrival
+    size_t i = count++;
+    for (; i > 0 && slot(i - 1).time > time; i--)
+        slot(i) = slot(i - 1);
+    slot(i) = {time, value, source};
+    ASSERT(i + 1 == count || slot(i + 1).time >= time);
+}
+
+double SensorStore::fuse(simtime_t since, long *numFused) const {
+    double sum = 0;
+    long n = 0;
+    // readings are held in arrival order
+    for (size_t i = count; i > 0 && at(i - 1).time >= since; i--) {
+        sum += at(i - 1).value;
+        n++;
+    }
+    if (numFused != nullptr)
+        *numFused = n;
+    return n > 0 ? sum / n : 0;
+}
+
+}
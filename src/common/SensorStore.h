@@ -0,0 +1,74 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+
+#ifndef COMMON_SENSORSTORE_H_
+#define COMMON_SENSORSTORE_H_
+
+#include <vector>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+using std::vector;
+
+namespace inet {
+
+/**
+ * A sensor reading as received by a fusion node or the master: when it
+ * arrived, from which module, and its value (the age of the data on arrival).
+ * Answers that came through the controller, as flows or from another
+ * partition, carry the controller as their source.
+ */
+struct SensorReading {
+    simtime_t time;
+    double value;
+    int source; // module id of the sender
+};
+
+/**
+ * The readings received by a node, in a ring of fixed capacity, ordered by
+ * arrival time even when they are stored out of order. Readings older than
+ * the retention window are dropped when the next one is stored, and once the
+ * ring is full the oldest is overwritten, so memory stays flat over long runs
+ * however many readings arrive.
+ */
+class SensorStore {
+
+    private:
+        vector<SensorReading> ring;
+        size_t first = 0; // oldest reading held
+        size_t count = 0;
+        simtime_t retention = -1; // negative: bounded by the capacity only
+        simtime_t newest; // latest arrival stored so far
+        long numReceived = 0;
+
+        const SensorReading& at(size_t i) const { return ring[(first + i) % ring.size()]; }
+        SensorReading& slot(size_t i) { return ring[(first + i) % ring.size()]; }
+        void expire(simtime_t now);
+
+    public:
+        void configure(int capacity, simtime_t retention);
+        void store(int source, simtime_t time, double value);
+
+        size_t size() const { return count; }
+        long getNumReceived() const { return numReceived; } // including those dropped since
+
+        // mean value of the readings held that arrived at or after since, and how many there were
+        double fuse(simtime_t since, long *numFused = nullptr) const;
+};
+
+}
+
+#endif /* COMMON_SENSORSTORE_H_ */